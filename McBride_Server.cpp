@@ -5,6 +5,8 @@
 #include <event2/thread.h>
 
 #include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 
 #include <arpa/inet.h>
 #include <string.h>
@@ -23,8 +25,20 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <atomic>
 
 #include "class_HTTP_Server.h"
+#include "class_HTTP_Parser.h"
+#include "class_Arena.h"
+#include "alloc_stats.h"
+#include "http_response.h"
+#include "class_File_Cache.h"
+#include "class_Content_Cache.h"
+#include "class_Access_Log.h"
+#include "server_stats.h"
+#include "request_handling.h"
+#include "class_Slab_Pool.h"
+#include "class_Timer_Wheel.h"
 
 #define ELPP_THREAD_SAFE
 #include "easylogging++.h"
@@ -41,36 +55,6 @@ INITIALIZE_EASYLOGGINGPP
 const char* METHOD_GET = "GET";
 const char* URI_ROOT = "/";
 
-std::string Make400(const std::string &problem, const std::string &req)
-{
-  std::string es("HTTP/1.1 400 Bad Request: ");
-  es += problem;
-  es += req;
-  es += "\n\n";
-  return es;
-}
-
-std::string Make404(const std::string &file)
-{
-  std::string es("HTTP/1.1 404 Not Found: ");
-  es += file;
-  es += "\n\n";
-  return es;
-}
-
-std::string Make500()
-{
-  return std::string("HTTP/1.1 500 Internal Server Error: cannot allocate memory\n");
-}
-
-std::string Make501(const std::string &file)
-{
-  std::string es("HTTP/1.1 501 Not Implemented: ");
-  es += file;
-  es += "\n\n";
-  return es;
-}
-
 /********************************
 *
 *
@@ -79,62 +63,77 @@ std::string Make501(const std::string &file)
 *
 ********************************/
 
-const static timeval tenSeconds = {10, 0}; // ten second timeout
+// Timeouts are checked ten times a second, and all of a worker's that
+// fall due within one tick are handled together
+const static uint64_t TIMER_TICK_NS = 100 * 1000 * 1000;
+const static timeval timerTick = {0, 100 * 1000};
+
+// What a connection is waiting for, which decides how long it may wait
+enum timeout_kind { TIMEOUT_HEADER, TIMEOUT_KEEPALIVE, TIMEOUT_WRITE };
+static const char* const TIMEOUT_NAMES[] = { "HEADER", "KEEP-ALIVE", "WRITE" };
+
+const static size_t CONTENT_CACHE_MAX_OBJECT = 1 << 20; // bigger files are always sent from disk
+
+struct worker_thread;
 
+// Pooled by the worker: the bufferevent and arena are created the first
+// time the slot is used and kept for every connection after.
 struct connection_info 
 {
+  connection_info():
+      port(-1), bev(NULL), waiting_for(TIMEOUT_HEADER), server(NULL), worker(NULL), served(0),
+      batch_start(0), drain_start(0), closing(false), live(false)
+  {
+    tag[0] = '\0';
+  }
+
   int port;
   bufferevent *bev;
-  event* timeout_event;
+  wheel_timer timeout;       // on the worker's wheel; one at a time
+  timeout_kind waiting_for;  // what the armed timeout is for
   HTTP_Server *server;
-
-  std::string 
+  worker_thread *worker;
+  HTTP_Parser parser; // holds the state of a partially received request
+  Arena arena;        // everything built for the current batch
+  unsigned long served; // requests answered so far
+  uint64_t batch_start; // now_ns() when the current batch was read
+  uint64_t drain_start; // when output was last queued onto an empty buffer, 0 once written
+  bool closing;         // close as soon as the output has been written
+  bool live;            // handed out by the pool
+  char tag[16];
+
+  const char*
   port_s() const {
-    std::ostringstream ss;
-    ss << "[" << std::setfill('0') << std::setw(2) << port << "]: ";
-    return ss.str();
+    return tag;
   }
 };
 
-class http_request {
-public:
-  http_request(const std::string &root) {
-    m_root = root;
-    isValid = true;
-  }
-
-  void
-  uri_set(const std::string& uri)
-  {
-    m_uri = uri;
-    m_full_uri = m_root + m_uri;
-  }
-
-  const std::string&
-  uri() const {
-    return m_uri;
-  }
-
-  const std::string&
-  full_uri() const {
-    return m_full_uri;
-  }
-
-  bool keepAlive() {
-    if (other_attrs["Connection"].compare("keep-alive") == 0) return true;
-    else return false;
-  }
-
-  bool isValid;
-  std::string error_string;
-  std::string method;
-  std::string http_version;
-  std::map<std::string, std::string> other_attrs;
-
-private:
-  std::string m_root;
-  std::string m_uri;
-  std::string m_full_uri;
+struct worker_thread
+{
+  int id;
+  pthread_t thread;
+  event_base *base;
+  event *notify_event;
+  int notify_fds[2]; // accepted sockets are written to [1], read from [0]
+  evconnlistener *listener; // own SO_REUSEPORT listener in sharded mode
+  std::atomic<int> active_connections;
+  Date_Cache date;
+  File_Cache *files; // shared by all workers
+  Content_Cache *bodies; // likewise
+  Log_Ring *access_log; // this worker's, NULL if logging is off
+  worker_stats stats;   // only written by this worker
+  const std::vector<worker_thread*> *peers; // every worker, this one included
+  Slab_Pool<connection_info> connections; // only touched by this worker
+  Timer_Wheel timers;   // the connections' timeouts
+  event *tick_event;    // advances the wheel while it has timers in it
+  bool ticking;
+  std::atomic<unsigned long> accepted; // only written by this worker
+  // Heap allocations made while answering requests, only written by this
+  // worker. operator new and libevent are counted separately.
+  std::atomic<unsigned long> batches;
+  std::atomic<unsigned long> batch_heap_allocations;
+  std::atomic<unsigned long> batch_event_allocations;
+  HTTP_Server *server;
 };
 
 /********************************
@@ -145,28 +144,6 @@ private:
 *
 ********************************/
 
-std::string
-file_extension(const std::string& filename)
-{
-  std::string::size_type idx = filename.rfind('.');
-
-  if (idx != std::string::npos)
-  {
-    return filename.substr(idx);
-  }
-  else
-  {
-    // No extension found
-    return "";
-  }
-}
-
-bool
-file_exists(const std::string& name) {
-  struct stat buffer;
-  return (stat (name.c_str(), &buffer) == 0); 
-}
-
 std::string
 getCmdOption(const char ** begin, const char ** end, const std::string & option)
 {
@@ -184,151 +161,57 @@ cmdOptionExists(const char** begin, const char** end, const std::string& option)
   return std::find(begin, end, option) != end;
 }
 
-bool
-splitHeaders(const std::string &s, std::pair<std::string, std::string>& pair)
+// Counts the response and hands it to the access log thread. Never
+// blocks; if the log has fallen behind the record is dropped and counted.
+void
+LogAccess(connection_info *ci, int status, const str_ref &uri, size_t bytes, bool keepAlive, const char *note = NULL)
 {
-  std::stringstream ss(s);
-  std::string item;
-
-  // get the key
-  std::getline(ss, item, ':');
-  if (item.compare("") == 0) return false; //blank key
-  pair.first = item;
-
-  // get the value, and strip the space
-  std::getline(ss, item);
-  if (item.at(0) == ' ') {
-    item.erase(0,1);
-  }
-  pair.second = item;
-  return true;
+  worker_stats &stats = ci->worker->stats;
+  int slot = slot_for_status(status);
+  bump(stats.responses[slot]);
+  stats.by_status[slot].record(now_ns() - ci->batch_start);
+  if ( ci->served++ > 0 ) bump(stats.keepalive_reuses);
+
+  Log_Ring *ring = ci->worker->access_log;
+  if ( !ring ) return;
+
+  access_record r;
+  r.time = ci->worker->date.now();
+  r.status = status;
+  r.keep_alive = keepAlive;
+  r.connection = ci->port;
+  r.bytes = bytes;
+  r.note = note;
+  r.uri_len = uri.len < access_record::URI_MAX ? uri.len : access_record::URI_MAX;
+  memcpy(r.uri, uri.data, r.uri_len);
+  ring->push(r);
 }
 
-std::vector<http_request>
-CreateRequests(bufferevent *ev, connection_info *ci)
+// The status page: every worker's counters added up, as text or, with
+// "?format=prometheus", in the Prometheus exposition format. Returns
+// the size of the body.
+size_t
+ServeStatus(connection_info *ci, evbuffer *output, const str_ref &query, bool keepAlive)
 {
-  evbuffer *input = bufferevent_get_input(ev);
-
-  std::vector<http_request> requests;
-  http_request req(ci->server->file_root());
-
-  for (int i = 1; ; ++i)
+  const std::vector<worker_thread*> &peers = *ci->worker->peers;
+  stats_totals total;
+  std::vector<stats_totals> workers(peers.size());
+  for (size_t i = 0; i < peers.size(); ++i)
   {
-    size_t n;
-    char *line = evbuffer_readln(input, &n, EVBUFFER_EOL_CRLF);
-    
-    if ( !line ) {
-      if ( i == 1 ) {
-        VLOG(3) << "Total pipelined requests: " << requests.size();
-        return requests;
-      }
-      VLOG(3) << "Middle of parsing request, blank line.";
-      goto begin_next;
-    }
-    if ( i == 1 ) {
-      // First line of HTTP Request...
-      // Should have METHOD URI HTTP_VERSION
-      std::istringstream ss(line);
-
-      // Parse out the method
-      if ( !(ss>>req.method) ) {
-        LOG(WARNING) << ci->port_s() << "Unable to parse HTTP Method.";
-        LOG(WARNING) << ci->port_s() << "\t[" << line << "]";
-        req.isValid = false;
-        req.error_string = "Unable to parse HTTP Method.";
-        goto begin_next;
-      }
-      VLOG(2) << ci->port_s() << "req.method= " << req.method;
-
-      // Parse out the uri
-      std::string uri;
-      if ( !(ss>>uri) ) {
-        LOG(WARNING) << ci->port_s() << "Unable to parse HTTP URI.";
-        LOG(WARNING) << ci->port_s() << "\t[" << line << "]";
-        req.isValid = false;
-        req.error_string = "Unable to parse HTTP URI.";
-        goto begin_next;
-      }
-      req.uri_set(uri);
-      VLOG(2) << ci->port_s() << "req.uri= " << req.uri() << " [" << req.full_uri() << "]";
-
-      // Parse out the http version
-      if ( !(ss>>req.http_version) ) {
-        LOG(WARNING) << ci->port_s() << "Unable to parse HTTP Version.";
-        LOG(WARNING) << ci->port_s() << "\t[" << line << "]";
-        req.isValid = false;
-        req.error_string = "Unable to parse HTTP Version.";
-        goto begin_next;
-      }
-      VLOG(2) << ci->port_s() << "req.http_version= " << req.http_version;
-    }
-    else {
-      // We need to try and see if the client is pipelining
-      // requests, and if they are, it's probabaly separated
-      // by a newline here.. Reset the count back to one
-      if (strlen(line) == 0) goto begin_next;
-
-      /*
-      This is any other content sent along with the request,
-      such as Connection: keep-alive
-      */
-
-      std::pair<std::string, std::string> pair;
-      bool b = splitHeaders(line, pair);
-      if (b)
-      {
-        req.other_attrs.insert(pair);
-        VLOG(3) << ci->port_s() << "req.other_attrs[" << pair.first << "]= " << pair.second;
-      }
-      continue;
-    }
-    continue;
-
-    // This begin_next goto statement happens when a request is followed
-    // up with a blankline
-    begin_next:
-      //LOG(DEBUG) << "[[" << __LINE__ << "]]: " << "starting new request";
-      requests.push_back(req);
-      req = http_request(ci->server->file_root());
-      i=0;
-      continue;
+    workers[i].add(peers[i]->stats, peers[i]->active_connections);
+    total.add(peers[i]->stats, peers[i]->active_connections);
   }
-  return requests;
-}
 
-std::string
-MakeSuccessHeader(
-  const std::string& mime_type,
-  const size_t length,
-  std::map<std::string, std::string>& other_attrs
-  )
-{
-  std::string connection;
-  if (other_attrs["Connection"].compare("keep-alive") == 0) {
-    connection = "Connection: keep-alive\n";
-  }
-  else {
-    connection = "Connection: close\n";
-  }
+  bool prometheus = query.equals("format=prometheus");
+  std::string body = prometheus ? format_prometheus(total, workers) : format_status(total, workers);
+  const char *mime = prometheus ? "text/plain; version=0.0.4" : "text/plain";
 
-  time_t rawtime;
-  time(&rawtime);
-  tm *gm = gmtime(&rawtime);
-
-  char time_buffer[80];
-  strftime(time_buffer, 80, "%a, %d %b %Y %H:%M:%S GMT\n", gm);
-
-  std::ostringstream ss;
-  ss << 
-        "HTTP/1.1 200 OK\n" <<
-        connection <<
-        "Date: " << time_buffer <<
-        "Content-Type: " << mime_type << "\n" <<
-        "Content-Length: " << length << "\n"
-  ;
-
-  ss << "\n"; // have this last to separate the header from content
-  return ss.str();
+  char header_buffer[512];
+  Header_Builder builder(header_buffer, sizeof header_buffer);
+  str_ref header = MakeSuccessHeader(builder, ci->worker->date, mime, body.size(), keepAlive);
+  evbuffer_add(output, header.data, header.len);
+  evbuffer_add(output, body.data(), body.size());
+  return body.size();
 }
 
 /********************************
@@ -339,13 +222,50 @@ MakeSuccessHeader(
 *
 ********************************/
 
+// Arms the connection's timeout for what it is waiting on now. The
+// length comes from the current config, so a reload applies from the
+// next wait on.
+void
+set_timeout(connection_info *ci, timeout_kind kind, uint64_t now)
+{
+  const server_config *c = ci->server->config();
+  int seconds = kind == TIMEOUT_HEADER ? c->header_timeout
+              : kind == TIMEOUT_KEEPALIVE ? c->keepalive_timeout
+              : c->write_timeout;
+
+  worker_thread *w = ci->worker;
+  uint64_t tick = now / TIMER_TICK_NS;
+  // An empty wheel hasn't been advanced, catch it up first
+  if ( w->timers.size() == 0 ) w->timers.advance(tick, NULL, NULL);
+  ci->waiting_for = kind;
+  w->timers.arm(&ci->timeout, tick + seconds * (1000000000ull / TIMER_TICK_NS));
+  if ( !w->ticking )
+  {
+    event_add(w->tick_event, &timerTick);
+    w->ticking = true;
+  }
+}
+
 void
 close_connection(connection_info* ci)
 {
-  bufferevent_free(ci->bev);
-  event_del( ci->timeout_event );
-  // event_base_loopexit(ci-> )
-  // free(ci);
+  // The bufferevent stays with the slot for the next connection; only
+  // the socket and whatever was buffered for it go
+  ci->live = false;
+  ci->worker->timers.disarm(&ci->timeout);
+  bufferevent_disable(ci->bev, EV_READ|EV_WRITE);
+  evutil_closesocket(bufferevent_getfd(ci->bev));
+  bufferevent_setfd(ci->bev, -1);
+  evbuffer *input = bufferevent_get_input(ci->bev);
+  evbuffer *output = bufferevent_get_output(ci->bev);
+  evbuffer_drain(input, evbuffer_get_length(input));
+  evbuffer_drain(output, evbuffer_get_length(output));
+  ci->parser.reset();
+  ci->arena.reset();
+
+  worker_thread *w = ci->worker;
+  --w->active_connections;
+  w->connections.put(ci);
 }
 
 void
@@ -353,28 +273,69 @@ callback_event(bufferevent *event, short events, void *conn_info)
 {
   connection_info* ci = reinterpret_cast<connection_info*>(conn_info);
 
-  if ( (events & (BEV_EVENT_READING|BEV_EVENT_EOF)) )
+  if ( (events & (BEV_EVENT_READING|BEV_EVENT_EOF|BEV_EVENT_ERROR)) )
   {
-    VLOG(1) << ci->port_s() << "Closing (CLIENT EOF)";
+    VLOG(1) << ci->port_s() << ((events & BEV_EVENT_EOF) ? "Closing (CLIENT EOF)" : "Closing (ERROR)");
     close_connection(ci);
     return;
   }
 }
 
 void
-callback_timeout(evutil_socket_t fd, short what, void* conn_info)
+fire_timeout(wheel_timer *t, void *context)
 {
-  connection_info* ci = reinterpret_cast<connection_info*>(conn_info);
-  VLOG(1) << ci->port_s() << "Closing (TIMEOUT)";
+  connection_info* ci = reinterpret_cast<connection_info*>(t->data);
+  bump(ci->worker->stats.timeouts);
+  VLOG(1) << ci->port_s() << "Closing (TIMEOUT " << TIMEOUT_NAMES[ci->waiting_for] << ")";
   close_connection(ci);
 }
 
+void
+callback_timer_tick(evutil_socket_t fd, short what, void *worker)
+{
+  worker_thread *w = reinterpret_cast<worker_thread*>(worker);
+  w->timers.advance(now_ns() / TIMER_TICK_NS, fire_timeout, NULL);
+  if ( w->timers.size() == 0 )
+  {
+    event_del(w->tick_event);
+    w->ticking = false;
+  }
+}
+
+// Any of the response being written out counts as progress against
+// the write timeout
+void
+callback_output_progress(evbuffer *output, const evbuffer_cb_info *info, void *conn_info)
+{
+  connection_info *ci = reinterpret_cast<connection_info*>(conn_info);
+  if ( info->n_deleted == 0 || !ci->live || ci->waiting_for != TIMEOUT_WRITE ) return;
+  set_timeout(ci, TIMEOUT_WRITE, now_ns());
+}
+
+// The output buffer has been written out to the socket
 void
 callback_data_written(bufferevent *bev, void *conn_info)
 {
   connection_info *ci = reinterpret_cast<connection_info*>(conn_info);
-  VLOG(1) << ci->port_s() << "Closing (WRITEOUT)";
-  close_connection(ci);
+  if ( ci->drain_start )
+  {
+    ci->worker->stats.stages[STAGE_DRAIN].record(now_ns() - ci->drain_start);
+    ci->drain_start = 0;
+  }
+  if ( ci->closing )
+  {
+    VLOG(1) << ci->port_s() << "Closing (WRITEOUT)";
+    close_connection(ci);
+    return;
+  }
+
+  // Also called once when the connection opens, with nothing written
+  if ( ci->waiting_for != TIMEOUT_WRITE ) return;
+
+  // Waiting on the client again: for the rest of a request it has
+  // started, or for a new one
+  if ( evbuffer_get_length(bufferevent_get_input(bev)) == 0 ) set_timeout(ci, TIMEOUT_KEEPALIVE, now_ns());
+  else if ( ci->waiting_for != TIMEOUT_HEADER ) set_timeout(ci, TIMEOUT_HEADER, now_ns());
 }
 
 void
@@ -382,170 +343,495 @@ callback_read(bufferevent *ev, void *conn_info)
 {
   // LOG(ERROR) << __PRETTY_FUNCTION__;
   connection_info* ci = reinterpret_cast<connection_info*>(conn_info);
-  // First reset the timer on the connection
-  event_del( ci->timeout_event );
+  uint64_t t_start = now_ns();
+  ci->batch_start = t_start;
+  worker_stats &stats = ci->worker->stats;
 
   evbuffer *input = bufferevent_get_input(ev);
   evbuffer *output = bufferevent_get_output(ev);
   bool keepAlive = false;
+  unsigned long heap_before = heap_allocations();
+  unsigned long event_before = event_allocations();
+  size_t queued_before = evbuffer_get_length(output);
+  size_t batch = 0;
 
   /*
     Go create any HTTP requests that may have been
-    pipelined, parse them out, and get a vector of
+    pipelined, parse them out, and get a list of
     them
   */
 
-  std::vector<http_request> requests = CreateRequests(ev, ci);
+  http_request *requests;
+  size_t consumed = CreateRequests(bufferevent_get_input(ev), ci->parser, ci->arena, ci->port_s(), &requests);
 
-  //LOG(DEBUG) << "number of requests to service= " << requests.size();
+  if ( !requests )
+  {
+    // Only part of a request so far, wait for the rest of it. The
+    // header timeout runs from the first byte and isn't extended by
+    // the ones after; while a response is going out the write timeout
+    // stays in charge. The request the parser was handed is thrown
+    // away, so a header sent a byte at a time reuses the same memory.
+    if ( ci->waiting_for == TIMEOUT_KEEPALIVE ) set_timeout(ci, TIMEOUT_HEADER, t_start);
+    ci->arena.reset();
+    return;
+  }
+  stats.stages[STAGE_PARSE].record(now_ns() - t_start);
   
-  for ( auto it = requests.begin(); it != requests.end(); ++it )
+  for ( http_request *it = requests; it; it = it->next )
   {
     //LOG(DEBUG) << "Servicing request.. ";
     http_request &req = *it;
+    ++batch;
 
     if ( !req.isValid ) {
-      LOG(ERROR) << "Request not valid.";
+      bump(stats.parse_errors);
+      // Whatever follows a malformed request can't be trusted
+      str_ref e = Make400(ci->arena, "", req.error_string);
+      LogAccess(ci, 400, req.target, 0, false, req.error_string);
+      evbuffer_add( output, e.data, e.len );
+      keepAlive = false;
+      break;
     }
 
-    if ( !(req.http_version.compare("HTTP/1.0") == 0) && !(req.http_version.compare("HTTP/1.1") == 0) ) {
-      std::string e = Make400("Invalid HTTP-Version: ", req.http_version);
-      LOG(WARNING) << ci->port_s() << "<400>: " << e;
-      bufferevent_write( ev, e.c_str(), e.length() );
+    if ( !req.http_version.equals("HTTP/1.0") && !req.http_version.equals("HTTP/1.1") ) {
+      str_ref e = Make400(ci->arena, "Invalid HTTP-Version: ", req.http_version);
+      LogAccess(ci, 400, req.target, 0, req.keepAlive(), "Invalid HTTP-Version");
+      bufferevent_write( ev, e.data, e.len );
       continue;
     }
 
-    if (req.method.compare(METHOD_GET) == 0)
+    if ( req.method.equals(METHOD_GET) )
     {
-      if ( req.uri().compare(URI_ROOT) == 0 )
+      if ( req.uri().equals(URI_ROOT) ) VLOG(1) << ci->port_s() << "Client requested the root page";
+
+      const std::string &status_uri = ci->server->config()->status_uri;
+      if ( !status_uri.empty() && req.uri().starts_with(status_uri) )
       {
-        VLOG(1) << ci->port_s() << "Client requested the root page";
-        std::vector<std::string> index_pages = ci->server->index_pages();
-        bool rootFound = false;
-        for (std::vector<std::string>::iterator it = index_pages.begin(); it != index_pages.end(); ++it)
-        {
-          std::string f(ci->server->file_root());
-          f += *it;
-
-          VLOG(2) << ci->port_s() << "Root file exists? [" << f << "]";
-          if ( file_exists(f) ) {
-            VLOG(2) << ci->port_s() << ".....true";
-            req.uri_set(*it);
-            rootFound = true;
-            break;
-          }
-          else {
-            VLOG(2) << ci->port_s() << ".....false";
-          }
-        }
-        if ( !rootFound )
+        str_ref rest = req.uri().substr(status_uri.size());
+        if ( rest.empty() || rest[0] == '?' )
         {
-          std::string e = Make404(req.uri());
-          LOG(WARNING) << ci->port_s() << "<404>: " << req.uri();
-          bufferevent_write( ev, e.c_str(), e.length() );
-          if ( req.keepAlive() ) keepAlive = true;
-          keepAlive = false;
-          continue;
-        }
-      }
-      else
-      {
-        if ( !file_exists(req.full_uri()) ) {
-          std::string e = Make404(req.uri());
-          LOG(WARNING) << ci->port_s() << "<404>: " << req.uri();
-          // bufferevent_write( ev, e.c_str(), e.length() );
-          evbuffer_add( output, e.c_str(), e.length() );
-          // if ( req.keepAlive() ) keepAlive = true;
-          // keepAlive = false;
+          size_t length = ServeStatus(ci, output, rest.substr(1), req.keepAlive());
+          LogAccess(ci, 200, req.uri(), length, req.keepAlive());
+          keepAlive = req.keepAlive();
           continue;
         }
       }
 
-      int fd = open( req.full_uri().c_str(), O_RDONLY );
-      if ( fd < 0 ) {
-        std::string e = Make500();
-        LOG(WARNING) << ci->port_s() << "<500> Couldn't open file." << req.full_uri();
-        bufferevent_write( ev, e.c_str(), e.length() );
-        if ( req.keepAlive() ) keepAlive = true;
+      uint64_t t_resolve = now_ns();
+      File_Cache *files = ci->worker->files;
+      const cached_file *f = files->get(req.uri(), ci->worker->date.now());
+
+      if ( f->status == cached_file::NOT_FOUND )
+      {
+        str_ref e = Make404(ci->arena, req.uri());
+        LogAccess(ci, 404, req.uri(), 0, req.keepAlive());
+        evbuffer_add( output, e.data, e.len );
+        files->release(f);
         continue;
       }
-      struct stat fd_stat;
-      fstat(fd, &fd_stat); // get the file size that we're sending to the buffer
 
-      std::string extension = file_extension(req.uri());
-      VLOG(2) << ci->port_s() << "Requested extension: " << extension;
+      VLOG(2) << ci->port_s() << "Requested extension: " << f->extension;
 
-      if ( !(ci->server->extAllowed(extension)) )
+      if ( f->status == cached_file::NOT_ALLOWED )
       {
         // file type not allowed by config file
-        std::string e = Make501(req.uri());
+        str_ref e = Make501(ci->arena, req.uri());
         
-        LOG(WARNING) << ci->port_s() << "<501>: " << "File type restricted.. Requested: " << extension;
-        bufferevent_write( ev, e.c_str(), e.length() );
+        LogAccess(ci, 501, req.uri(), 0, req.keepAlive(), "File type restricted");
+        bufferevent_write( ev, e.data, e.len );
+        if ( req.keepAlive() ) keepAlive = true;
+        files->release(f);
+        continue;
+      }
+
+      if ( f->status == cached_file::OPEN_FAILED ) {
+        str_ref e = Make500();
+        LogAccess(ci, 500, req.uri(), 0, req.keepAlive(), "Couldn't open file");
+        bufferevent_write( ev, e.data, e.len );
         if ( req.keepAlive() ) keepAlive = true;
+        files->release(f);
         continue;
       }
 
-      std::string header = MakeSuccessHeader(ci->server->get_mime(extension), fd_stat.st_size, req.other_attrs);
+      char header_buffer[512];
+
+      // The file or one of its precompressed variants; everything below
+      // is about that one, but f holds the reference on both
+      const cached_file &rep = Negotiate(req, *f);
 
-      evbuffer_add(output, header.c_str(), header.length() );
-      evbuffer_add_file(output, fd, 0, fd_stat.st_size);
-      const char* newLine = "\n";
-      evbuffer_add(output, newLine, strlen(newLine));
-      
-      if ( req.keepAlive() )
+      // The client's copy is current: the validators were worked out
+      // when the file was opened, so this is a couple of compares
+      if ( NotModified(req, rep) )
       {
-        LOG(INFO) << ci->port_s() << "<200>: " << req.uri() << " ~ (KEEP-ALIVE)";
-        keepAlive = true;
+        str_ref header = BuildHeader(ci->arena, header_buffer, sizeof header_buffer, [&](Header_Builder &b) {
+          return MakeNotModifiedHeader(b, ci->worker->date, rep, req.keepAlive());
+        });
+        stats.stages[STAGE_RESOLVE].record(now_ns() - t_resolve);
+        evbuffer_add(output, header.data, header.len);
+        LogAccess(ci, 304, req.uri(), 0, req.keepAlive());
+        files->release(f);
+        keepAlive = req.keepAlive();
+        continue;
       }
-      else
+
+      // Only some of it, sent straight from the file at the right offsets
+      byte_range ranges[MAX_RANGES];
+      int range_count = RequestedRanges(req, rep, ranges);
+      if ( range_count >= 0 )
       {
-        LOG(INFO) << ci->port_s() << "<200>: " << req.uri() << " ~ (CLOSE)";
-        keepAlive = false;
+        int status = 206;
+        size_t length = 0;
+        if ( range_count == 0 )
+        {
+          str_ref header = BuildHeader(ci->arena, header_buffer, sizeof header_buffer, [&](Header_Builder &b) {
+            return MakeRangeNotSatisfiableHeader(b, ci->worker->date, rep, req.keepAlive());
+          });
+          evbuffer_add(output, header.data, header.len);
+          status = 416;
+        }
+        else if ( range_count == 1 )
+        {
+          str_ref header = BuildHeader(ci->arena, header_buffer, sizeof header_buffer, [&](Header_Builder &b) {
+            return MakePartialHeader(b, ci->worker->date, rep, ranges[0], req.keepAlive());
+          });
+          evbuffer_add(output, header.data, header.len);
+          evbuffer_add_file_segment(output, rep.segment, ranges[0].first, ranges[0].length());
+          length = ranges[0].length();
+        }
+        else
+        {
+          length = AddByteranges(output, ci->arena, ci->worker->date, rep, ranges, range_count, req.keepAlive());
+        }
+        stats.stages[STAGE_RESOLVE].record(now_ns() - t_resolve);
+        LogAccess(ci, status, req.uri(), length, req.keepAlive());
+        files->release(f);
+        keepAlive = req.keepAlive();
+        continue;
       }
+
+      const cached_body *body = ci->worker->bodies->get(&rep);
+      uint64_t t_header = now_ns();
+      stats.stages[STAGE_RESOLVE].record(t_header - t_resolve);
+
+      bool preserialized = body && body->head_len;
+      str_ref header = BuildHeader(ci->arena, header_buffer, sizeof header_buffer, [&](Header_Builder &b) {
+        return preserialized
+            ? StartFileHeader(b, ci->worker->date, rep, req.keepAlive()).text()
+            : MakeFileHeader(b, ci->worker->date, rep, req.keepAlive());
+      });
+      uint64_t t_enqueue = now_ns();
+      stats.stages[STAGE_HEADER].record(t_enqueue - t_header);
+
+      // The output buffer takes its own reference on the body or the
+      // file segment
+      evbuffer_add(output, header.data, header.len);
+      if ( preserialized ) Content_Cache::add_response(output, body);
+      else if ( body ) Content_Cache::add_to_buffer(output, body);
+      else evbuffer_add_file_segment(output, rep.segment, 0, rep.size);
+      stats.stages[STAGE_ENQUEUE].record(now_ns() - t_enqueue);
+
+      if ( body ) ci->worker->bodies->release(body);
+      LogAccess(ci, 200, req.uri(), rep.size, req.keepAlive());
+      files->release(f);
+      keepAlive = req.keepAlive();
     } // GET method
     else {
-      std::string e = Make400("Invalid Method: ", req.method);
-      LOG(WARNING) << "<400>: Invalid Method: " << req.method;
-      bufferevent_write( ev, e.c_str(), e.length() );
+      str_ref e = Make400(ci->arena, "Invalid Method: ", req.method);
+      LogAccess(ci, 400, req.target, 0, req.keepAlive(), "Invalid Method");
+      bufferevent_write( ev, e.data, e.len );
       if ( req.keepAlive() ) keepAlive = true;
       continue;
     }
   }
 
+  // The requests pointed into the input buffer and the arena, so only now
+  // can both let go
+  evbuffer_drain(input, consumed);
+  ci->arena.reset();
+
+  worker_thread *w = ci->worker;
+  // Drain time runs from when the buffer last had nothing left to write
+  if ( queued_before == 0 && evbuffer_get_length(output) > 0 ) ci->drain_start = now_ns();
+  bump(w->stats.bytes_sent, evbuffer_get_length(output) - queued_before);
+  bump(w->stats.batches[batch_bucket(batch)]);
+  bump(w->stats.batch_requests, batch);
+  unsigned long heap = heap_allocations() - heap_before;
+  unsigned long events = event_allocations() - event_before;
+  w->batches.store(w->batches.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  w->batch_heap_allocations.store(w->batch_heap_allocations.load(std::memory_order_relaxed) + heap, std::memory_order_relaxed);
+  w->batch_event_allocations.store(w->batch_event_allocations.load(std::memory_order_relaxed) + events, std::memory_order_relaxed);
+  VLOG(2) << ci->port_s() << "Allocations for this batch: " << heap << " operator new, "
+          << events << " libevent, " << ci->arena.mallocs() << " arena blocks so far";
+
   // After we have processed and responded to all of the requests,
   // we need to figure out what to do with the connection..
   // bufferevent_free(ev);
-  if (keepAlive)
+  VLOG(3) << ci->port_s() << "Keep-alive = " << (keepAlive ? "true" : "false");
+  ci->closing = !keepAlive;
+  if ( evbuffer_get_length(output) > 0 ) set_timeout(ci, TIMEOUT_WRITE, now_ns());
+  else if ( keepAlive ) set_timeout(ci, TIMEOUT_KEEPALIVE, now_ns());
+  else close_connection(ci);
+}
+
+
+/********************************
+*
+*
+* Worker threads
+*
+*
+********************************/
+
+// Every connection lives on exactly one worker. Each worker owns one
+// event_base for its whole lifetime and runs every connection it is
+// given on that base.
+void
+open_connection(worker_thread *w, evutil_socket_t newSocket)
+{
+  connection_info *ci = w->connections.get();
+  if ( !ci->bev )
   {
-    VLOG(3) << ci->port_s() << "Keep-alive = true";
-    event_add(ci->timeout_event, &tenSeconds);
+    // A slot that has never been used
+    ci->bev = bufferevent_socket_new(w->base, -1, BEV_OPT_CLOSE_ON_FREE);
+    if ( !ci->bev )
+    {
+      LOG(ERROR) << "couldn't create bufferevent.. ignoring connection";
+      w->connections.put(ci);
+      evutil_closesocket(newSocket);
+      --w->active_connections;
+      return;
+    }
+    ci->server = w->server;
+    ci->worker = w;
+    ci->timeout.data = ci;
+    bufferevent_setcb(ci->bev, callback_read, callback_data_written, callback_event, (void*)ci);
+    bufferevent_setwatermark(ci->bev, EV_WRITE, 0, 0);
+    evbuffer_add_cb(bufferevent_get_output(ci->bev), callback_output_progress, ci);
   }
-  else
+
+  ci->port = newSocket;
+  snprintf(ci->tag, sizeof ci->tag, "[%02d]: ", newSocket);
+  ci->served = 0;
+  ci->batch_start = 0;
+  ci->drain_start = 0;
+  ci->closing = false;
+  ci->live = true;
+  bump(w->stats.connections);
+
+  bufferevent_setfd(ci->bev, newSocket);
+  bufferevent_enable(ci->bev, EV_READ|EV_WRITE);
+  set_timeout(ci, TIMEOUT_HEADER, now_ns());
+  VLOG(1) << ci->port_s() << "Opened on worker " << w->id;
+}
+
+// Handoff mode: the listening thread writes accepted sockets into the
+// worker's notify pipe.
+void
+callback_worker_notify(evutil_socket_t fd, short what, void *worker)
+{
+  worker_thread *w = reinterpret_cast<worker_thread*>(worker);
+
+  evutil_socket_t newSocket;
+  while ( read(fd, &newSocket, sizeof newSocket) == sizeof newSocket )
   {
-    VLOG(3) << ci->port_s() << "Keep-alive = false";
-    bufferevent_setcb(ev, callback_read, callback_data_written, callback_event, (void*)ci);
+    w->accepted.store(w->accepted.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    open_connection(w, newSocket);
   }
 }
 
+// Sharded mode: every worker accepts on its own SO_REUSEPORT socket,
+// and the kernel spreads the incoming connections between them.
+void
+callback_shard_accept(
+  evconnlistener *listener,
+  evutil_socket_t newSocket,
+  sockaddr *address,
+  int socklen,
+  void *worker
+  )
+{
+  worker_thread *w = reinterpret_cast<worker_thread*>(worker);
+  w->accepted.store(w->accepted.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  ++w->active_connections;
+  open_connection(w, newSocket);
+}
+
+void
+callback_accept_error(struct evconnlistener *listener, void *ctx)
+{
+  struct event_base *base = evconnlistener_get_base(listener);
+  int err = EVUTIL_SOCKET_ERROR();
+  LOG(FATAL) << "Got error <" << err << ": " << evutil_socket_error_to_string(err) << "> on the connection listener. Shutting down.";
+
+  event_base_loopexit(base, NULL);
+}
+
+void
+pin_to_cpu(worker_thread *w)
+{
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if ( cpus < 1 ) return;
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(w->id % cpus, &set);
+  int err = pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+  if ( err != 0 )
+  {
+    LOG(WARNING) << "Couldn't pin worker " << w->id << " to CPU " << (w->id % cpus) << ": " << strerror(err);
+    return;
+  }
+  VLOG(1) << "Worker " << w->id << " pinned to CPU " << (w->id % cpus);
+}
 
-// all new connections spawn a thread with this was their routine
 void*
-thread_listener(void *conn_info)
+thread_worker(void *worker)
 {
-  pthread_t   tid;
-  tid = pthread_self();
-  connection_info *ci = reinterpret_cast<connection_info*>(conn_info);
-  LOG(WARNING) << "Thread " << tid << " conn " << ci->port;
-  // LOG(WARNING) << "In thread " << ci->port;
-  bufferevent_enable(ci->bev, EV_READ|EV_WRITE);
-  event_base *base = bufferevent_get_base(ci->bev);
-  event_reinit(base);
-  event_base_dispatch(base);
-  VLOG(1) << ci->port_s() << "Thread killed";
+  worker_thread *w = reinterpret_cast<worker_thread*>(worker);
+  if ( w->server->pin_workers() ) pin_to_cpu(w);
+  VLOG(1) << "Worker " << w->id << " started";
+  event_base_dispatch(w->base);
+  VLOG(1) << "Worker " << w->id << " exiting";
+
+  // Everything the worker's base owns is freed on this thread, before
+  // the base itself
+  w->connections.for_each([](connection_info *ci) {
+    if ( ci->live ) close_connection(ci);
+    if ( ci->bev ) bufferevent_free(ci->bev);
+    ci->bev = NULL;
+  });
+  event_free(w->tick_event);
+  if ( w->listener ) evconnlistener_free(w->listener);
+  if ( w->notify_event ) event_free(w->notify_event);
+  w->listener = NULL;
+  w->notify_event = NULL;
+  event_base_free(w->base);
+  w->base = NULL;
   return NULL;
 }
 
+// Stops every worker's loop and waits for it to clean up
+void
+stop_workers(std::vector<worker_thread*> &workers)
+{
+  for (size_t i = 0; i < workers.size(); ++i) event_base_loopexit(workers[i]->base, NULL);
+  for (size_t i = 0; i < workers.size(); ++i)
+  {
+    pthread_join(workers[i]->thread, NULL);
+    if ( workers[i]->notify_fds[0] >= 0 ) close(workers[i]->notify_fds[0]);
+    if ( workers[i]->notify_fds[1] >= 0 ) close(workers[i]->notify_fds[1]);
+  }
+}
+
+bool
+start_workers(HTTP_Server *server, File_Cache *files, Content_Cache *bodies, Access_Log *access_log, const sockaddr_in &address, std::vector<worker_thread*> &workers)
+{
+  for (int i = 0; i < server->workers(); ++i)
+  {
+    worker_thread *w = new worker_thread();
+    w->id = i;
+    w->server = server;
+    w->active_connections = 0;
+    w->accepted = 0;
+    w->batches = 0;
+    w->batch_heap_allocations = 0;
+    w->batch_event_allocations = 0;
+    w->listener = NULL;
+    w->notify_event = NULL;
+    w->notify_fds[0] = w->notify_fds[1] = -1;
+    w->base = event_base_new();
+    if ( !w->base )
+    {
+      LOG(FATAL) << "Error creating an event loop for worker " << i;
+      return false;
+    }
+    w->date.attach(w->base);
+    w->tick_event = event_new(w->base, -1, EV_PERSIST, callback_timer_tick, w);
+    w->ticking = false;
+    w->files = files;
+    w->bodies = bodies;
+    w->access_log = access_log ? access_log->add_ring() : NULL;
+    w->peers = &workers;
+
+    if ( server->reuse_port() )
+    {
+      w->listener = evconnlistener_new_bind(
+                                     w->base,
+                                     callback_shard_accept,
+                                     w,
+                                     LEV_OPT_CLOSE_ON_FREE|LEV_OPT_REUSEABLE|LEV_OPT_REUSEABLE_PORT,
+                                     -1,
+                                     (sockaddr*)&address,
+                                     sizeof address
+                                     );
+      if ( !w->listener )
+      {
+        LOG(FATAL) << "Error creating the SO_REUSEPORT listener for worker " << i << ": " << strerror(errno);
+        return false;
+      }
+      evconnlistener_set_error_cb(w->listener, callback_accept_error);
+    }
+    else
+    {
+      if ( pipe(w->notify_fds) != 0 )
+      {
+        LOG(FATAL) << "Error creating notify pipe for worker " << i << ": " << strerror(errno);
+        return false;
+      }
+      evutil_make_socket_nonblocking(w->notify_fds[0]);
+      w->notify_event = event_new(w->base, w->notify_fds[0], EV_READ|EV_PERSIST, callback_worker_notify, w);
+      event_add(w->notify_event, NULL);
+    }
+
+    workers.push_back(w);
+  }
+
+  // Only once the list is complete, the workers read it
+  for (size_t i = 0; i < workers.size(); ++i)
+  {
+    if ( pthread_create(&workers[i]->thread, NULL, &thread_worker, (void*)workers[i]) != 0 )
+    {
+      LOG(FATAL) << "Error starting worker thread " << i;
+      return false;
+    }
+  }
+  return true;
+}
+
+struct listener_context
+{
+  HTTP_Server *server;
+  std::string conf_path;
+  File_Cache *files;
+  Content_Cache *bodies;
+  Access_Log *access_log;
+  event_base *base;
+  std::vector<worker_thread*> workers;
+  size_t next_worker;
+};
+
+// Pick the least loaded worker, starting the scan at a rotating offset
+// so that ties are broken round-robin.
+worker_thread*
+pick_worker(listener_context *lc)
+{
+  size_t n = lc->workers.size();
+  size_t start = lc->next_worker++ % n;
+  worker_thread *best = lc->workers[start];
+  int best_load = best->active_connections;
+  for (size_t i = 1; i < n && best_load > 0; ++i)
+  {
+    worker_thread *w = lc->workers[(start + i) % n];
+    int load = w->active_connections;
+    if ( load < best_load )
+    {
+      best = w;
+      best_load = load;
+    }
+  }
+  return best;
+}
+
 void 
 callback_accept_connection(
   evconnlistener *listener,
@@ -555,57 +841,124 @@ callback_accept_connection(
   void *context
   )
 {
-  // LOG(ERROR) << __PRETTY_FUNCTION__;
-  HTTP_Server *server = reinterpret_cast<HTTP_Server*>(context);
-  event_base *newEventBase = event_base_new();
-  if (!newEventBase)
+  listener_context *lc = reinterpret_cast<listener_context*>(context);
+  worker_thread *w = pick_worker(lc);
+
+  ++w->active_connections;
+  if ( write(w->notify_fds[1], &newSocket, sizeof newSocket) != sizeof newSocket )
   {
-    LOG(WARNING) << "Failed to create new event base for incoming connection.. Using main thread's event base.";
-    newEventBase = evconnlistener_get_base(listener);
+    LOG(ERROR) << "Couldn't hand connection to worker " << w->id << ": " << strerror(errno);
+    --w->active_connections;
+    evutil_closesocket(newSocket);
   }
-  bufferevent *bev = bufferevent_socket_new(newEventBase,
-                                            newSocket,
-                                            BEV_OPT_CLOSE_ON_FREE);
+}
 
-  if (!bev)
+void
+report_accept_counts(listener_context *lc)
+{
+  const std::vector<worker_thread*> &workers = lc->workers;
+  unsigned long total = 0;
+  for (std::vector<worker_thread*>::const_iterator it = workers.begin(); it != workers.end(); ++it)
   {
-    LOG(FATAL) << "couldn't create bufferevent.. ignoring connection";
-    return;
+    unsigned long n = (*it)->accepted.load(std::memory_order_relaxed);
+    total += n;
+    LOG(INFO) << "Worker " << (*it)->id << ": accepted " << n << ", active " << (*it)->active_connections
+              << ", " << (*it)->batches << " batches answered with " << (*it)->batch_heap_allocations
+              << " operator new and " << (*it)->batch_event_allocations << " libevent allocations";
   }
+  LOG(INFO) << "Total accepted: " << total;
+  LOG(INFO) << "File cache: " << lc->files->hits() << " hits, " << lc->files->misses() << " misses";
+  if ( lc->bodies->enabled() )
+  {
+    Content_Cache::stats c = lc->bodies->totals();
+    LOG(INFO) << "Content cache: " << c.hits << " hits, " << c.misses << " misses, "
+              << c.admissions << " admitted, " << c.rejections << " rejected, " << c.evictions << " evicted, "
+              << c.entries << " files in " << c.bytes << " bytes";
+  }
+  if ( lc->access_log )
+  {
+    LOG(INFO) << "Access log: " << lc->access_log->written() << " written, " << lc->access_log->dropped() << " dropped";
+  }
+}
 
-  connection_info *ci = new connection_info();
-  event *e = event_new(newEventBase, -1, EV_TIMEOUT, callback_timeout, ci);
-
-  ci->port = newSocket;
-  ci->bev = bev;
-  ci->timeout_event = e;
-  ci->server = server;
+// A config snapshot that has been replaced. Workers only look at the
+// snapshot while they are inside a callback, so once every worker has
+// run the callback below nobody can still be using it.
+struct retired_config
+{
+  const server_config *config;
+  std::atomic<int> pending;
+};
 
-  bufferevent_setcb(bev, callback_read, NULL, callback_event, (void*)ci);
-  bufferevent_setwatermark(bev, EV_WRITE, 0, 0);
-  
-  // LOG(WARNING) << "Accepting connection on " << newSocket;
-  pthread_t pt;
-  pthread_create(&pt,
-                 NULL,
-                 &thread_listener,
-                 (void*)ci
-                 );
+void
+callback_config_quiescent(evutil_socket_t fd, short what, void *context)
+{
+  retired_config *r = reinterpret_cast<retired_config*>(context);
+  if ( r->pending.fetch_sub(1, std::memory_order_acq_rel) != 1 ) return;
+  delete r->config;
+  delete r;
 }
 
 void
-callback_accept_error(struct evconnlistener *listener, void *ctx)
+reload_config(listener_context *lc)
 {
-  struct event_base *base = evconnlistener_get_base(listener);
-  int err = EVUTIL_SOCKET_ERROR();
-  LOG(FATAL) << "Got error <" << err << ": " << evutil_socket_error_to_string(err) << "> on the connection listener. Shutting down.";
+  LOG(INFO) << "Reloading " << lc->conf_path;
+  const server_config *old = lc->server->Reload(lc->conf_path);
+  if ( !old )
+  {
+    LOG(ERROR) << "Couldn't parse " << lc->conf_path << ", keeping the running configuration";
+    return;
+  }
 
-  event_base_loopexit(base, NULL);
+  // Requests being answered right now finish on the old snapshot
+  size_t dropped = lc->files->invalidate(*old, *lc->server->config());
+  LOG(INFO) << "Configuration reloaded, " << dropped << " cached paths invalidated";
+
+  retired_config *r = new retired_config();
+  r->config = old;
+  r->pending = lc->workers.size() + 1;
+  for (std::vector<worker_thread*>::iterator it = lc->workers.begin(); it != lc->workers.end(); ++it)
+  {
+    if ( event_base_once((*it)->base, -1, EV_TIMEOUT, callback_config_quiescent, r, NULL) != 0 )
+    {
+      LOG(ERROR) << "Couldn't reach worker " << (*it)->id << ", the old configuration won't be freed";
+    }
+  }
+  callback_config_quiescent(-1, 0, r);
+}
+
+void
+callback_signal(evutil_socket_t sig, short what, void *context)
+{
+  listener_context *lc = reinterpret_cast<listener_context*>(context);
+  if ( sig == SIGUSR1 )
+  {
+    report_accept_counts(lc);
+    return;
+  }
+  if ( sig == SIGHUP )
+  {
+    reload_config(lc);
+    return;
+  }
+  LOG(INFO) << "Caught signal " << sig << ", shutting down.";
+  event_base_loopexit(lc->base, NULL);
 }
 
 int
 main(const int argc, const char** argv)
 {
+  // libevent's allocator has to be hooked before anything else touches it
+  install_event_alloc_counter();
+
+  // Cached file segments are shared between the workers' buffers, so
+  // libevent needs its locks
+  if ( evthread_use_pthreads() != 0 )
+  {
+    LOG(FATAL) << "couldn't start libevent with pthreads..";
+    return -1;
+  }
+
   // start the easylogging++.h library
   START_EASYLOGGINGPP(argc, argv); 
   el::Configurations conf;
@@ -626,11 +979,8 @@ main(const int argc, const char** argv)
     return -1;
   }
 
-  // if ( evthread_use_pthreads() )
-  // {
-  //   LOG(FATAL) << "couldn't start libevent with pthreads..";
-  //   return -1;
-  // }
+  // A client hanging up mid-response must not kill the whole server
+  signal(SIGPIPE, SIG_IGN);
 
   event_base *listeningBase = event_base_new();
   if ( !listeningBase )
@@ -646,24 +996,76 @@ main(const int argc, const char** argv)
   incomingSocket.sin_addr.s_addr = 0; // local host
   incomingSocket.sin_port = htons(server->port());
 
-  evconnlistener *listener = evconnlistener_new_bind(
+  listener_context *lc = new listener_context();
+  lc->server = server;
+  lc->conf_path = confFilePath;
+  lc->base = listeningBase;
+  lc->next_worker = 0;
+  lc->files = new File_Cache(server);
+  lc->bodies = new Content_Cache(server->cache_size(), CONTENT_CACHE_MAX_OBJECT);
+  lc->access_log = NULL;
+  if ( server->config()->access_log != "off" )
+  {
+    lc->access_log = new Access_Log();
+    if ( !lc->access_log->open(server->config()->access_log, server->config()->access_log_binary) )
+    {
+      LOG(FATAL) << "Couldn't open the access log " << server->config()->access_log << ": " << strerror(errno);
+      return -2;
+    }
+  }
+  if ( !start_workers(server, lc->files, lc->bodies, lc->access_log, incomingSocket, lc->workers) )
+  {
+    LOG(FATAL) << "Error starting worker threads.. Exiting";
+    return -2;
+  }
+  if ( lc->access_log && !lc->access_log->start() )
+  {
+    LOG(FATAL) << "Couldn't start the access log thread.. Exiting";
+    return -2;
+  }
+
+  evconnlistener *listener = NULL;
+  if ( server->reuse_port() )
+  {
+    LOG(INFO) << "Accepting on " << lc->workers.size() << " SO_REUSEPORT shards";
+  }
+  else
+  {
+    listener = evconnlistener_new_bind(
                                      listeningBase,
                                      callback_accept_connection,
-                                     server,
+                                     lc,
                                      LEV_OPT_CLOSE_ON_FREE|LEV_OPT_REUSEABLE  ,
                                      -1,
                                      (sockaddr*)&incomingSocket,
                                      sizeof incomingSocket
                                      );
 
-  if ( !listener )
-  {
-    LOG(FATAL) << "Error creating a TCP socket listener.. Exiting.";
-    return -3;
+    if ( !listener )
+    {
+      LOG(FATAL) << "Error creating a TCP socket listener.. Exiting.";
+      return -3;
+    }
+    evconnlistener_set_error_cb(listener, callback_accept_error);
   }
 
-  evconnlistener_set_error_cb(listener, callback_accept_error);
+  // The main loop stays alive on these even when it isn't accepting
+  event *sigint = evsignal_new(listeningBase, SIGINT, callback_signal, lc);
+  event *sigterm = evsignal_new(listeningBase, SIGTERM, callback_signal, lc);
+  event *sigusr1 = evsignal_new(listeningBase, SIGUSR1, callback_signal, lc);
+  event *sighup = evsignal_new(listeningBase, SIGHUP, callback_signal, lc);
+  event_add(sigint, NULL);
+  event_add(sigterm, NULL);
+  event_add(sigusr1, NULL);
+  event_add(sighup, NULL);
+
   event_base_dispatch(listeningBase);
 
+  // No more connections are handed out, so the workers can go, and once
+  // they have nothing more is logged
+  if ( listener ) evconnlistener_free(listener);
+  stop_workers(lc->workers);
+  if ( lc->access_log ) lc->access_log->stop();
+  report_accept_counts(lc);
   return 0;
 }
@@ -0,0 +1,54 @@
+#include "alloc_stats.h"
+#include <stdlib.h>
+#include <new>
+#include <event2/event.h>
+
+static __thread unsigned long t_heap_allocations = 0;
+static __thread unsigned long t_event_allocations = 0;
+
+unsigned long
+heap_allocations()
+{
+  return t_heap_allocations;
+}
+
+unsigned long
+event_allocations()
+{
+  return t_event_allocations;
+}
+
+static void*
+counting_malloc(size_t n)
+{
+  ++t_event_allocations;
+  return malloc(n);
+}
+
+static void*
+counting_realloc(void *p, size_t n)
+{
+  ++t_event_allocations;
+  return realloc(p, n);
+}
+
+void
+install_event_alloc_counter()
+{
+  event_set_mem_functions(counting_malloc, counting_realloc, free);
+}
+
+void*
+operator new(size_t n)
+{
+  ++t_heap_allocations;
+  void *p = malloc(n ? n : 1);
+  if ( !p ) throw std::bad_alloc();
+  return p;
+}
+
+void
+operator delete(void *p) noexcept
+{
+  free(p);
+}
@@ -0,0 +1,15 @@
+#ifndef ALLOC_STATS_H
+#define ALLOC_STATS_H
+
+// Per-thread heap allocation counters, so the request path can prove it
+// doesn't allocate. Linking alloc_stats.cpp replaces the global
+// operator new to count C++ allocations; install_event_alloc_counter()
+// hooks libevent's allocator the same way and has to run before any
+// other libevent call.
+
+unsigned long heap_allocations();   // operator new calls on this thread
+unsigned long event_allocations();  // libevent malloc/realloc calls on this thread
+
+void install_event_alloc_counter();
+
+#endif
@@ -0,0 +1,171 @@
+// Benchmark for serving the www-Many page's files.
+//
+// Sends every file under www-Many through a socketpair, the way the
+// server answers a GET, with
+//   disk     - open, fstat and evbuffer_add_file per request, as before
+//              any caching
+//   segment  - a file segment opened once, as File_Cache hands it out
+//   memory   - the body from Content_Cache with evbuffer_add_reference
+// A second thread drains the other end of the socketpair. Prints the
+// cost per file sent for each.
+//
+// g++ --std=c++11 -O2 -o bench_cache bench/bench_cache.cpp class_Content_Cache.cpp http_response.cpp -levent -lpthread
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+
+#include <event2/buffer.h>
+
+#include "../class_File_Cache.h"
+#include "../class_Content_Cache.h"
+
+static double
+now()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void*
+drain(void *arg)
+{
+  int fd = *static_cast<int*>(arg);
+  char buf[65536];
+  while ( read(fd, buf, sizeof buf) > 0 ) ;
+  return NULL;
+}
+
+static void
+flush(evbuffer *out, int fd)
+{
+  while ( evbuffer_get_length(out) > 0 )
+  {
+    if ( evbuffer_write(out, fd) < 0 )
+    {
+      perror("evbuffer_write");
+      exit(1);
+    }
+  }
+}
+
+static bool
+open_file(const std::string &path, cached_file &f)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  struct stat st;
+  if ( fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) )
+  {
+    if ( fd >= 0 ) close(fd);
+    return false;
+  }
+  f.path = path;
+  f.fd = fd;
+  f.size = st.st_size;
+  f.mtime = st.st_mtime;
+  f.inode = st.st_ino;
+  f.segment = evbuffer_file_segment_new(fd, 0, st.st_size, EVBUF_FS_CLOSE_ON_FREE);
+  return f.segment != NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+  const char *root = argc > 1 ? argv[1] : "www-Many";
+  const int ROUNDS = argc > 2 ? atoi(argv[2]) : 2000;
+
+  std::vector<std::string> paths;
+  DIR *dir = opendir(root);
+  if ( !dir )
+  {
+    perror(root);
+    return 1;
+  }
+  while ( dirent *d = readdir(dir) )
+  {
+    if ( d->d_name[0] != '.' ) paths.push_back(std::string(root) + "/" + d->d_name);
+  }
+  closedir(dir);
+
+  std::vector<cached_file*> files;
+  size_t bytes = 0;
+  for (size_t i = 0; i < paths.size(); ++i)
+  {
+    cached_file *f = new cached_file();
+    if ( !open_file(paths[i], *f) ) continue;
+    files.push_back(f);
+    bytes += f->size;
+  }
+  printf("%zu files, %zu bytes per page\n", files.size(), bytes);
+
+  int sv[2];
+  if ( socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0 )
+  {
+    perror("socketpair");
+    return 1;
+  }
+  pthread_t reader;
+  pthread_create(&reader, NULL, drain, &sv[1]);
+
+  Content_Cache bodies(64 << 20, 1 << 20);
+  evbuffer *out = evbuffer_new();
+  const char *modes[] = { "disk", "segment", "memory" };
+  printf("%-8s %10s %10s\n", "mode", "ns/file", "MB/s");
+  for (int m = 0; m < 3; ++m)
+  {
+    double t = now();
+    for (int r = 0; r < ROUNDS; ++r)
+    {
+      for (size_t i = 0; i < files.size(); ++i)
+      {
+        cached_file *f = files[i];
+        if ( m == 0 )
+        {
+          int fd = open(f->path.c_str(), O_RDONLY);
+          struct stat st;
+          if ( fd < 0 || fstat(fd, &st) != 0 ) continue;
+          evbuffer_add_file(out, fd, 0, st.st_size);
+        }
+        else if ( m == 1 )
+        {
+          evbuffer_add_file_segment(out, f->segment, 0, f->size);
+        }
+        else
+        {
+          const cached_body *b = bodies.get(f);
+          if ( b )
+          {
+            Content_Cache::add_to_buffer(out, b);
+            bodies.release(b);
+          }
+          else
+          {
+            evbuffer_add_file_segment(out, f->segment, 0, f->size);
+          }
+        }
+        flush(out, sv[0]);
+      }
+    }
+    double elapsed = now() - t;
+    double sent = static_cast<double>(ROUNDS) * files.size();
+    printf("%-8s %10.1f %10.1f\n", modes[m], elapsed * 1e9 / sent, ROUNDS * bytes / elapsed / 1e6);
+  }
+
+  Content_Cache::stats s = bodies.totals();
+  printf("content cache: %lu hits, %lu misses, %lu evictions\n", s.hits, s.misses, s.evictions);
+
+  shutdown(sv[0], SHUT_WR);
+  pthread_join(reader, NULL);
+  evbuffer_free(out);
+  return 0;
+}
@@ -0,0 +1,678 @@
+// HTTP/1.1 load generator for benchmarking the server over loopback.
+//
+// Each thread runs its share of the connections on its own epoll set.
+// The URLs come from a page's src= and href= links (by default
+// www-Many/index.html, so serve www-Many as the DocumentRoot), plus the
+// page itself, and are requested round robin.
+//
+//   closed loop  every connection keeps --pipeline requests in flight
+//                and sends the next one as soon as a response is in
+//   open loop    requests are scheduled at a fixed --rate regardless of
+//                how quickly they are answered; latency runs from when
+//                a request was due, not when it could be sent, so a
+//                stalled server shows up in the tail instead of just
+//                slowing the load down
+//
+// With --close every request gets its own connection and its latency
+// includes the connect. Responses sent in the first --warmup seconds
+// aren't counted. Results go to stdout as JSON.
+//
+// g++ --std=c++11 -O2 -o bench_http bench/bench_http.cpp server_stats.cpp -lpthread
+//
+// bench_http [--host 127.0.0.1] [--port 8097] [--threads 1]
+//            [--connections 50] [--duration 10] [--warmup 1]
+//            [--rate N (open loop, requests/s over all threads)]
+//            [--pipeline 1] [--close] [--page www-Many/index.html]
+//            [--prefix /] [--url /path ...]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <deque>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../server_stats.h"
+
+struct options
+{
+  options():
+      host("127.0.0.1"), port(8097), threads(1), connections(50), duration(10), warmup(1),
+      rate(0), pipeline(1), keep_alive(true), page("www-Many/index.html"), prefix("/")
+  {}
+
+  std::string host;
+  int port;
+  int threads;
+  int connections;
+  double duration;
+  double warmup;
+  double rate; // 0 for closed loop
+  int pipeline;
+  bool keep_alive;
+  std::string page;
+  std::string prefix;
+  std::vector<std::string> urls;
+};
+
+// What one thread saw, added up at the end
+struct thread_result
+{
+  thread_result():
+      responses(0), bytes(0), status_2xx(0), status_3xx(0), status_4xx(0), status_5xx(0),
+      connects(0), connect_errors(0), read_errors(0), unfinished(0), max_latency(0)
+  {}
+
+  uint64_t responses;
+  uint64_t bytes;
+  uint64_t status_2xx;
+  uint64_t status_3xx;
+  uint64_t status_4xx;
+  uint64_t status_5xx;
+  uint64_t connects;
+  uint64_t connect_errors;
+  uint64_t read_errors; // resets, closes with requests outstanding, unparsable responses
+  uint64_t unfinished;  // still outstanding when time ran out
+  uint64_t max_latency;
+  latency_histogram latency;
+};
+
+struct connection
+{
+  connection(): fd(-1), connected(false), writing(false), out_off(0), status(0), header_done(false),
+                body_left(0), server_closes(false) {}
+
+  int fd;
+  bool connected;
+  bool writing;           // EPOLLOUT is armed
+  std::string out;
+  size_t out_off;
+  std::deque<uint64_t> sent; // when each outstanding request was due
+  std::string in;
+
+  // The response being read
+  int status;
+  bool header_done;
+  size_t body_left;
+  bool server_closes;
+};
+
+struct worker
+{
+  const options *opt;
+  const std::vector<std::string> *requests;
+  int id;
+  int connection_count;
+  uint64_t start;
+  uint64_t measure_from;
+  uint64_t stop;
+  thread_result result;
+  pthread_t thread;
+};
+
+static sockaddr_in server_address;
+
+static bool
+parse_response_header(connection &c, size_t end)
+{
+  // "HTTP/1.x NNN"; the server's error responses are just this line
+  if ( c.in.compare(0, 5, "HTTP/") != 0 ) return false;
+  size_t sp = c.in.find(' ');
+  if ( sp == std::string::npos || sp + 4 > end ) return false;
+  c.status = atoi(c.in.c_str() + sp + 1);
+  c.body_left = 0;
+  c.server_closes = false;
+
+  size_t line = c.in.find('\n') + 1;
+  while ( line < end )
+  {
+    size_t next = c.in.find('\n', line);
+    if ( next == std::string::npos || next > end ) next = end;
+    size_t colon = c.in.find(':', line);
+    if ( colon != std::string::npos && colon < next )
+    {
+      std::string name = c.in.substr(line, colon - line);
+      size_t value = colon + 1;
+      while ( value < next && c.in[value] == ' ' ) ++value;
+      if ( strcasecmp(name.c_str(), "Content-Length") == 0 ) c.body_left = strtoull(c.in.c_str() + value, NULL, 10);
+      if ( strcasecmp(name.c_str(), "Connection") == 0 && strncasecmp(c.in.c_str() + value, "close", 5) == 0 )
+      {
+        c.server_closes = true;
+      }
+    }
+    line = next + 1;
+  }
+  return true;
+}
+
+// Position just past the blank line ending the header, or npos
+static size_t
+header_end(const std::string &in)
+{
+  for (size_t i = in.find('\n'); i != std::string::npos; i = in.find('\n', i + 1))
+  {
+    if ( i + 1 < in.size() && in[i+1] == '\n' ) return i + 2;
+    if ( i + 2 < in.size() && in[i+1] == '\r' && in[i+2] == '\n' ) return i + 3;
+  }
+  return std::string::npos;
+}
+
+class load_thread {
+public:
+  load_thread(worker &w):
+      m_w(w), m_opt(*w.opt), m_next_url(w.id), m_conns(w.connection_count), m_next_due(0), m_interval(0),
+      m_round_robin(0)
+  {
+    m_epoll = epoll_create1(0);
+    if ( m_opt.rate > 0 )
+    {
+      m_interval = static_cast<uint64_t>(1e9 * m_opt.threads / m_opt.rate);
+      if ( m_interval == 0 ) m_interval = 1;
+      m_next_due = w.start;
+    }
+  }
+
+  ~load_thread()
+  {
+    for (size_t i = 0; i < m_conns.size(); ++i)
+    {
+      if ( m_conns[i].fd >= 0 ) close(m_conns[i].fd);
+    }
+    close(m_epoll);
+  }
+
+  void
+  run()
+  {
+    // With --close, connections are opened as requests need them
+    if ( m_opt.keep_alive )
+    {
+      for (size_t i = 0; i < m_conns.size(); ++i) open_connection(m_conns[i]);
+    }
+    if ( m_opt.rate <= 0 )
+    {
+      for (size_t i = 0; i < m_conns.size(); ++i) fill(m_conns[i], now_ns());
+    }
+
+    epoll_event events[256];
+    for (;;)
+    {
+      uint64_t now = now_ns();
+      if ( now >= m_w.stop ) break;
+      if ( m_opt.rate > 0 ) schedule(now);
+
+      int timeout = static_cast<int>((m_w.stop - now) / 1000000);
+      if ( m_opt.rate > 0 ) timeout = m_next_due > now ? static_cast<int>((m_next_due - now) / 1000000) : 0;
+      int n = epoll_wait(m_epoll, events, 256, timeout);
+      for (int i = 0; i < n; ++i)
+      {
+        connection &c = m_conns[events[i].data.u32];
+        int fd = c.fd;
+        if ( events[i].events & (EPOLLERR | EPOLLHUP) && !c.connected ) connect_failed(c);
+        else if ( events[i].events & EPOLLOUT ) writable(c);
+        // The events were for the socket it had, not any it reconnected with
+        if ( c.fd >= 0 && c.fd == fd && c.connected && events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR) ) readable(c);
+      }
+    }
+
+    for (size_t i = 0; i < m_conns.size(); ++i) m_w.result.unfinished += m_conns[i].sent.size();
+    m_w.result.unfinished += m_backlog.size();
+  }
+
+private:
+  void
+  open_connection(connection &c)
+  {
+    c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    int one = 1;
+    setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    c.connected = false;
+    c.out.clear();
+    c.out_off = 0;
+    c.in.clear();
+    c.header_done = false;
+    ++m_w.result.connects;
+
+    int r = connect(c.fd, reinterpret_cast<sockaddr*>(&server_address), sizeof server_address);
+    if ( r != 0 && errno != EINPROGRESS )
+    {
+      connect_failed(c);
+      return;
+    }
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT;
+    ev.data.u32 = &c - &m_conns[0];
+    c.writing = true;
+    epoll_ctl(m_epoll, EPOLL_CTL_ADD, c.fd, &ev);
+  }
+
+  void
+  drop(connection &c)
+  {
+    close(c.fd);
+    c.fd = -1;
+    c.connected = false;
+    c.writing = false;
+  }
+
+  void
+  connect_failed(connection &c)
+  {
+    ++m_w.result.connect_errors;
+    m_w.result.unfinished += c.sent.size();
+    c.sent.clear();
+    drop(c);
+    // Don't spin on a server that isn't there
+    usleep(1000);
+    if ( m_opt.keep_alive )
+    {
+      open_connection(c);
+      if ( m_opt.rate <= 0 ) fill(c, now_ns());
+    }
+  }
+
+  // Queues one more request on c, due at the given time
+  void
+  send_request(connection &c, uint64_t due)
+  {
+    if ( c.fd < 0 ) open_connection(c);
+    if ( c.fd < 0 ) return;
+
+    const std::string &r = (*m_w.requests)[m_next_url++ % m_w.requests->size()];
+    c.out.append(r);
+    c.sent.push_back(due);
+    if ( c.connected ) writable(c);
+  }
+
+  // Closed loop: top c up to the pipeline depth
+  void
+  fill(connection &c, uint64_t now)
+  {
+    int depth = m_opt.keep_alive ? m_opt.pipeline : 1;
+    while ( static_cast<int>(c.sent.size()) < depth && now < m_w.stop ) send_request(c, now);
+  }
+
+  // Open loop: everything that has come due goes to a connection with
+  // room for it, or waits in the backlog
+  void
+  schedule(uint64_t now)
+  {
+    while ( m_next_due <= now )
+    {
+      m_backlog.push_back(m_next_due);
+      m_next_due += m_interval;
+    }
+
+    int depth = m_opt.keep_alive ? m_opt.pipeline : 1;
+    size_t tried = 0;
+    while ( !m_backlog.empty() && tried < m_conns.size() )
+    {
+      connection &c = m_conns[m_round_robin];
+      m_round_robin = (m_round_robin + 1) % m_conns.size();
+      bool idle = m_opt.keep_alive ? c.fd >= 0 : c.fd < 0;
+      if ( idle && static_cast<int>(c.sent.size()) < depth )
+      {
+        send_request(c, m_backlog.front());
+        m_backlog.pop_front();
+        tried = 0;
+      }
+      else
+      {
+        ++tried;
+      }
+    }
+  }
+
+  void
+  writable(connection &c)
+  {
+    if ( !c.connected )
+    {
+      int err = 0;
+      socklen_t len = sizeof err;
+      getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+      if ( err != 0 )
+      {
+        connect_failed(c);
+        return;
+      }
+      c.connected = true;
+    }
+
+    while ( c.out_off < c.out.size() )
+    {
+      ssize_t n = send(c.fd, c.out.data() + c.out_off, c.out.size() - c.out_off, MSG_NOSIGNAL);
+      if ( n < 0 )
+      {
+        if ( errno == EAGAIN ) break;
+        lost(c);
+        return;
+      }
+      c.out_off += n;
+    }
+    if ( c.out_off == c.out.size() )
+    {
+      c.out.clear();
+      c.out_off = 0;
+    }
+
+    bool want = !c.out.empty();
+    if ( want != c.writing )
+    {
+      epoll_event ev;
+      ev.events = want ? EPOLLIN | EPOLLOUT : EPOLLIN;
+      ev.data.u32 = &c - &m_conns[0];
+      epoll_ctl(m_epoll, EPOLL_CTL_MOD, c.fd, &ev);
+      c.writing = want;
+    }
+  }
+
+  // The connection went away with requests outstanding
+  void
+  lost(connection &c)
+  {
+    ++m_w.result.read_errors;
+    m_w.result.unfinished += c.sent.size();
+    c.sent.clear();
+    drop(c);
+    if ( m_opt.keep_alive )
+    {
+      open_connection(c);
+      if ( m_opt.rate <= 0 ) fill(c, now_ns());
+    }
+  }
+
+  void
+  readable(connection &c)
+  {
+    char buf[65536];
+    for (;;)
+    {
+      ssize_t n = read(c.fd, buf, sizeof buf);
+      if ( n > 0 )
+      {
+        if ( !responses(c, buf, n) ) return;
+        continue;
+      }
+      if ( n < 0 && errno == EAGAIN ) return;
+
+      // Closed by the server
+      if ( !c.sent.empty() ) lost(c);
+      else
+      {
+        drop(c);
+        if ( m_opt.keep_alive )
+        {
+          open_connection(c);
+          if ( m_opt.rate <= 0 ) fill(c, now_ns());
+        }
+      }
+      return;
+    }
+  }
+
+  // Consumes whatever complete responses buf finishes. false once c has
+  // been closed.
+  bool
+  responses(connection &c, const char *buf, size_t n)
+  {
+    size_t used = 0;
+    while ( used < n )
+    {
+      if ( !c.header_done )
+      {
+        size_t before = c.in.size();
+        c.in.append(buf + used, n - used);
+        size_t end = header_end(c.in);
+        if ( end == std::string::npos )
+        {
+          used = n;
+          break;
+        }
+        if ( !parse_response_header(c, end) || c.sent.empty() )
+        {
+          lost(c);
+          return false;
+        }
+        used += end - before;
+        m_w.result.bytes += end;
+        c.in.clear();
+        c.header_done = true;
+      }
+
+      size_t take = n - used < c.body_left ? n - used : c.body_left;
+      c.body_left -= take;
+      used += take;
+      m_w.result.bytes += take;
+      if ( c.body_left == 0 && !finished(c) ) return false;
+    }
+    return true;
+  }
+
+  // A whole response is in. false once c has been closed.
+  bool
+  finished(connection &c)
+  {
+    uint64_t now = now_ns();
+    uint64_t due = c.sent.front();
+    c.sent.pop_front();
+    c.header_done = false;
+
+    thread_result &r = m_w.result;
+    if ( due >= m_w.measure_from )
+    {
+      uint64_t latency = now - due;
+      r.latency.record(latency);
+      if ( latency > r.max_latency ) r.max_latency = latency;
+      ++r.responses;
+      if ( c.status < 300 ) ++r.status_2xx;
+      else if ( c.status < 400 ) ++r.status_3xx;
+      else if ( c.status < 500 ) ++r.status_4xx;
+      else ++r.status_5xx;
+    }
+
+    if ( !m_opt.keep_alive || c.server_closes )
+    {
+      m_w.result.unfinished += c.sent.size();
+      c.sent.clear();
+      drop(c);
+      if ( m_opt.keep_alive ) open_connection(c);
+      if ( m_opt.rate <= 0 ) fill(c, now);
+      return false;
+    }
+    if ( m_opt.rate <= 0 ) fill(c, now);
+    return true;
+  }
+
+  worker &m_w;
+  const options &m_opt;
+  int m_epoll;
+  size_t m_next_url;
+  std::vector<connection> m_conns;
+  std::deque<uint64_t> m_backlog;
+  uint64_t m_next_due;
+  uint64_t m_interval;
+  size_t m_round_robin;
+};
+
+static void*
+run_worker(void *arg)
+{
+  worker *w = static_cast<worker*>(arg);
+  load_thread t(*w);
+  t.run();
+  return NULL;
+}
+
+// The page plus every local src= and href= it links to
+static bool
+urls_from_page(const options &opt, std::vector<std::string> &urls)
+{
+  std::ifstream in(opt.page.c_str());
+  if ( !in ) return false;
+  std::stringstream ss;
+  ss << in.rdbuf();
+  std::string html = ss.str();
+
+  urls.push_back(opt.prefix);
+  const char *attrs[] = { "src=\"", "href=\"" };
+  for (int a = 0; a < 2; ++a)
+  {
+    for (size_t i = html.find(attrs[a]); i != std::string::npos; i = html.find(attrs[a], i + 1))
+    {
+      size_t start = i + strlen(attrs[a]);
+      size_t end = html.find('"', start);
+      if ( end == std::string::npos ) break;
+      std::string link = html.substr(start, end - start);
+      if ( link.empty() || link[0] == '#' || link.find("://") != std::string::npos ) continue;
+      if ( link.compare(0, 7, "mailto:") == 0 || link.compare(0, 11, "javascript:") == 0 ) continue;
+      urls.push_back(link[0] == '/' ? link : opt.prefix + link);
+    }
+  }
+  return true;
+}
+
+// A bucket's upper bound can be past the largest value actually seen
+static double
+quantile(const histogram_totals &h, double q, uint64_t max)
+{
+  uint64_t v = h.percentile(q);
+  return v < max ? v : max;
+}
+
+static void
+usage()
+{
+  fprintf(stderr,
+          "usage: bench_http [--host addr] [--port n] [--threads n] [--connections n]\n"
+          "                  [--duration s] [--warmup s] [--rate n] [--pipeline n] [--close]\n"
+          "                  [--page file.html] [--prefix /] [--url /path ...]\n");
+  exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+  options opt;
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string a = argv[i];
+    if ( a == "--close" ) { opt.keep_alive = false; continue; }
+    if ( i + 1 >= argc ) usage();
+    const char *v = argv[++i];
+    if ( a == "--host" ) opt.host = v;
+    else if ( a == "--port" ) opt.port = atoi(v);
+    else if ( a == "--threads" ) opt.threads = atoi(v);
+    else if ( a == "--connections" ) opt.connections = atoi(v);
+    else if ( a == "--duration" ) opt.duration = atof(v);
+    else if ( a == "--warmup" ) opt.warmup = atof(v);
+    else if ( a == "--rate" ) opt.rate = atof(v);
+    else if ( a == "--pipeline" ) opt.pipeline = atoi(v);
+    else if ( a == "--page" ) opt.page = v;
+    else if ( a == "--prefix" ) opt.prefix = v;
+    else if ( a == "--url" ) opt.urls.push_back(v);
+    else usage();
+  }
+  if ( opt.threads < 1 || opt.connections < opt.threads || opt.pipeline < 1 || opt.duration <= 0 ) usage();
+  if ( opt.prefix.empty() || opt.prefix[opt.prefix.size()-1] != '/' ) opt.prefix += '/';
+
+  memset(&server_address, 0, sizeof server_address);
+  server_address.sin_family = AF_INET;
+  server_address.sin_port = htons(opt.port);
+  if ( inet_pton(AF_INET, opt.host.c_str(), &server_address.sin_addr) != 1 )
+  {
+    fprintf(stderr, "bad address %s\n", opt.host.c_str());
+    return 2;
+  }
+
+  if ( opt.urls.empty() && !urls_from_page(opt, opt.urls) )
+  {
+    perror(opt.page.c_str());
+    return 1;
+  }
+
+  std::string host = opt.host + ":" + std::to_string(opt.port);
+  std::vector<std::string> requests;
+  for (size_t i = 0; i < opt.urls.size(); ++i)
+  {
+    requests.push_back("GET " + opt.urls[i] + " HTTP/1.1\r\nHost: " + host +
+                       "\r\nUser-Agent: bench_http\r\nConnection: " +
+                       (opt.keep_alive ? "keep-alive" : "close") + "\r\n\r\n");
+  }
+
+  std::vector<worker> workers(opt.threads);
+  uint64_t start = now_ns();
+  uint64_t measure_from = start + static_cast<uint64_t>(opt.warmup * 1e9);
+  uint64_t stop = measure_from + static_cast<uint64_t>(opt.duration * 1e9);
+  for (int i = 0; i < opt.threads; ++i)
+  {
+    worker &w = workers[i];
+    w.opt = &opt;
+    w.requests = &requests;
+    w.id = i;
+    w.connection_count = opt.connections / opt.threads + (i < opt.connections % opt.threads ? 1 : 0);
+    w.start = start;
+    w.measure_from = measure_from;
+    w.stop = stop;
+    pthread_create(&w.thread, NULL, run_worker, &w);
+  }
+
+  thread_result total;
+  histogram_totals latency;
+  for (int i = 0; i < opt.threads; ++i)
+  {
+    pthread_join(workers[i].thread, NULL);
+    const thread_result &r = workers[i].result;
+    total.responses += r.responses;
+    total.bytes += r.bytes;
+    total.status_2xx += r.status_2xx;
+    total.status_3xx += r.status_3xx;
+    total.status_4xx += r.status_4xx;
+    total.status_5xx += r.status_5xx;
+    total.connects += r.connects;
+    total.connect_errors += r.connect_errors;
+    total.read_errors += r.read_errors;
+    total.unfinished += r.unfinished;
+    if ( r.max_latency > total.max_latency ) total.max_latency = r.max_latency;
+    latency.add(r.latency);
+  }
+
+  double seconds = opt.duration;
+  double mean = latency.count ? static_cast<double>(latency.sum) / latency.count : 0;
+  printf("{\n");
+  printf("  \"config\": {\"host\": \"%s\", \"port\": %d, \"threads\": %d, \"connections\": %d, "
+         "\"duration\": %g, \"warmup\": %g, \"mode\": \"%s\", \"rate\": %g, \"pipeline\": %d, "
+         "\"keep_alive\": %s, \"urls\": %zu},\n",
+         opt.host.c_str(), opt.port, opt.threads, opt.connections, opt.duration, opt.warmup,
+         opt.rate > 0 ? "open" : "closed", opt.rate, opt.keep_alive ? opt.pipeline : 1,
+         opt.keep_alive ? "true" : "false", opt.urls.size());
+  printf("  \"requests\": %lu,\n", (unsigned long)total.responses);
+  printf("  \"requests_per_second\": %.1f,\n", total.responses / seconds);
+  printf("  \"bytes\": %lu,\n", (unsigned long)total.bytes);
+  printf("  \"megabytes_per_second\": %.2f,\n", total.bytes / seconds / 1e6);
+  printf("  \"status\": {\"2xx\": %lu, \"3xx\": %lu, \"4xx\": %lu, \"5xx\": %lu},\n",
+         (unsigned long)total.status_2xx, (unsigned long)total.status_3xx,
+         (unsigned long)total.status_4xx, (unsigned long)total.status_5xx);
+  printf("  \"connections_opened\": %lu,\n", (unsigned long)total.connects);
+  printf("  \"errors\": {\"connect\": %lu, \"read\": %lu, \"unfinished\": %lu},\n",
+         (unsigned long)total.connect_errors, (unsigned long)total.read_errors, (unsigned long)total.unfinished);
+  printf("  \"latency_us\": {\"mean\": %.1f, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, "
+         "\"p999\": %.1f, \"p9999\": %.1f, \"max\": %.1f}\n",
+         mean / 1e3, quantile(latency, 0.5, total.max_latency) / 1e3,
+         quantile(latency, 0.9, total.max_latency) / 1e3, quantile(latency, 0.99, total.max_latency) / 1e3,
+         quantile(latency, 0.999, total.max_latency) / 1e3, quantile(latency, 0.9999, total.max_latency) / 1e3,
+         total.max_latency / 1e3);
+  printf("}\n");
+  return 0;
+}
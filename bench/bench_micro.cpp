@@ -0,0 +1,214 @@
+// Microbenchmarks for the request path, run against the recorded
+// browser requests in request_corpus.h:
+//   CreateRequests     a single request and pipelined batches of 10 and
+//                      50, the last also split over two buffer chains
+//                      so it has to be pulled up
+//   parse+lookup       HTTP_Parser plus the header lookups the server
+//                      does (what splitHeaders used to be)
+//   StartSuccessHeader the per-request lines in front of a
+//                      preserialized header
+//   MakeFileHeader     a whole 200 header for a file, with and without
+//                      a cache lifetime
+//   file_extension     for a file name from the page
+//   mime_for           an allowed and a disallowed extension from ws.conf
+//                      (what get_mime and extAllowed used to be)
+//   timeout refresh    pushing back one of 10000 pending connection
+//                      timeouts, on the Timer_Wheel and as the per
+//                      connection libevent timer it replaced
+// Prints the cost per call (per request for the batches).
+//
+// Links against the request handling library; see BUILDING in README.
+//
+// g++ --std=c++11 -O2 -o bench_micro bench/bench_micro.cpp libmcbride.a -levent -lpthread
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#include <event2/buffer.h>
+#include <event2/event.h>
+
+#include "../class_HTTP_Server.h"
+#include "../class_File_Cache.h"
+#include "../request_handling.h"
+#include "../class_Timer_Wheel.h"
+#include "request_corpus.h"
+
+INITIALIZE_EASYLOGGINGPP
+
+static double
+now()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static volatile size_t sink;
+
+static void
+report(const char *name, const char *input, double elapsed, double calls)
+{
+  printf("%-20s %-18s %10.1f\n", name, input, elapsed * 1e9 / calls);
+}
+
+// Hands batch to CreateRequests the way a read would leave it in the
+// input buffer, in as many chains as it is split into
+static void
+bench_create(const char *input, const std::string &batch, int requests, int iterations, size_t split = 0)
+{
+  evbuffer *buf = evbuffer_new();
+  HTTP_Parser parser;
+  Arena arena;
+
+  double t = now();
+  for (int i = 0; i < iterations; ++i)
+  {
+    if ( split )
+    {
+      evbuffer_add_reference(buf, batch.data(), split, NULL, NULL);
+      evbuffer_add_reference(buf, batch.data() + split, batch.size() - split, NULL, NULL);
+    }
+    else
+    {
+      evbuffer_add_reference(buf, batch.data(), batch.size(), NULL, NULL);
+    }
+    http_request *reqs;
+    size_t used = CreateRequests(buf, parser, arena, "", &reqs);
+    for (http_request *r = reqs; r; r = r->next) sink += r->uri().len;
+    evbuffer_drain(buf, used);
+    arena.reset();
+  }
+  report("CreateRequests", input, now() - t, static_cast<double>(iterations) * requests);
+  evbuffer_free(buf);
+}
+
+static void
+bench_parse(const char *input, const char *request, int iterations)
+{
+  std::string req(request);
+  HTTP_Parser parser;
+  http_message msg;
+
+  double t = now();
+  for (int i = 0; i < iterations; ++i)
+  {
+    parser.parse(req.data(), req.size(), msg);
+    sink += msg.headers.get(H_CONNECTION).len + msg.headers.get(H_HOST).len +
+            msg.headers.get(str_ref("User-Agent")).len;
+  }
+  report("parse+lookup", input, now() - t, iterations);
+}
+
+int
+main(int argc, char **argv)
+{
+  const int ITERATIONS = argc > 1 ? atoi(argv[1]) : 200000;
+  const char *conf = argc > 2 ? argv[2] : "ws.conf";
+
+  el::Loggers::reconfigureAllLoggers(el::ConfigurationType::Enabled, "false");
+
+  printf("%-20s %-18s %10s\n", "function", "input", "ns/call");
+
+  bench_create("chrome", CHROME, 1, ITERATIONS);
+  bench_create("firefox", FIREFOX, 1, ITERATIONS);
+  bench_create("curl", CURL, 1, ITERATIONS);
+  bench_create("chrome x10", pipelined_batch(CHROME, 10), 10, ITERATIONS / 10);
+  bench_create("firefox x50", pipelined_batch(FIREFOX, 50), 50, ITERATIONS / 50);
+  std::string split = pipelined_batch(FIREFOX, 50);
+  bench_create("firefox x50 split", split, 50, ITERATIONS / 50, split.size() / 2);
+
+  bench_parse("chrome", CHROME, ITERATIONS);
+  bench_parse("firefox", FIREFOX, ITERATIONS);
+  bench_parse("curl", CURL, ITERATIONS);
+
+  // Outside the event loop Date_Cache has no cached clock to read, so
+  // these include a gettimeofday
+  Date_Cache date;
+  char header_buffer[512];
+  double t = now();
+  for (int i = 0; i < ITERATIONS; ++i)
+  {
+    Header_Builder builder(header_buffer, sizeof header_buffer);
+    sink += StartSuccessHeader(builder, date, true).text().len;
+  }
+  report("StartSuccessHeader", "keep-alive", now() - t, ITERATIONS);
+
+  cached_file file;
+  file.mime = "image/png";
+  file.size = 28338;
+  file.validators = "ETag: \"3a0412-6eb2-16b8c2f0e1a4c000\"\r\n"
+                    "Last-Modified: Sun, 06 Nov 1994 08:49:37 GMT\r\n";
+  file.max_age = -1;
+  t = now();
+  for (int i = 0; i < ITERATIONS; ++i)
+  {
+    Header_Builder builder(header_buffer, sizeof header_buffer);
+    sink += MakeFileHeader(builder, date, file, true).len;
+  }
+  report("MakeFileHeader", "image/png", now() - t, ITERATIONS);
+
+  file.max_age = 31536000;
+  file.cache_control = cache_lifetime(file.max_age, true).header();
+  t = now();
+  for (int i = 0; i < ITERATIONS; ++i)
+  {
+    Header_Builder builder(header_buffer, sizeof header_buffer);
+    sink += MakeFileHeader(builder, date, file, true).len;
+  }
+  report("MakeFileHeader", "png, lifetime", now() - t, ITERATIONS);
+
+  const str_ref names[] = { "/square17.png", "/css/style.css", "/jquery-1.4.3.min.js", "/README" };
+  t = now();
+  for (int i = 0; i < ITERATIONS; ++i) sink += file_extension(names[i & 3]).len;
+  report("file_extension", "mixed", now() - t, ITERATIONS);
+
+  HTTP_Server server;
+  if ( !server.ParseConfFile(conf) )
+  {
+    fprintf(stderr, "couldn't parse %s\n", conf);
+    return 1;
+  }
+  const server_config *config = server.config();
+  const str_ref allowed[] = { ".png", ".html", ".css", ".JS" };
+  t = now();
+  for (int i = 0; i < ITERATIONS; ++i) sink += config->mime_for(allowed[i & 3]).len;
+  report("mime_for", "allowed", now() - t, ITERATIONS);
+
+  const str_ref refused[] = { ".exe", ".php", ".sh", "" };
+  t = now();
+  for (int i = 0; i < ITERATIONS; ++i) sink += config->mime_for(refused[i & 3]).len;
+  report("mime_for", "not allowed", now() - t, ITERATIONS);
+
+  const int PENDING = 10000;
+  Timer_Wheel wheel;
+  std::vector<wheel_timer> timers(PENDING);
+  for (int i = 0; i < PENDING; ++i) wheel.arm(&timers[i], 100 + i % 100);
+  t = now();
+  for (int i = 0; i < ITERATIONS; ++i) wheel.arm(&timers[(i * 7919) % PENDING], 100 + i % 100);
+  report("timeout refresh", "Timer_Wheel", now() - t, ITERATIONS);
+
+  event_base *base = event_base_new();
+  std::vector<event*> events(PENDING);
+  for (int i = 0; i < PENDING; ++i)
+  {
+    timeval tv = { 10, i };
+    events[i] = event_new(base, -1, EV_TIMEOUT, NULL, NULL);
+    event_add(events[i], &tv);
+  }
+  t = now();
+  for (int i = 0; i < ITERATIONS; ++i)
+  {
+    timeval tv = { 10, i % 1000 };
+    event *e = events[(i * 7919) % PENDING];
+    event_del(e);
+    event_add(e, &tv);
+  }
+  report("timeout refresh", "libevent min-heap", now() - t, ITERATIONS);
+  for (int i = 0; i < PENDING; ++i) event_free(events[i]);
+  event_base_free(base);
+
+  return 0;
+}
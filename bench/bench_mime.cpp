@@ -0,0 +1,103 @@
+// Microbenchmark for the extension to Content-Type lookup.
+//
+// Looks up the extensions of the www-Many and www URIs, plus a few
+// that aren't allowed, with
+//   map    - the old std::map<std::string,std::string>, keyed by a
+//            freshly allocated extension string per request
+//   table  - Mime_Table on a str_ref suffix of the URI
+// and prints the cost per lookup for each.
+//
+// g++ --std=c++11 -O2 -o bench_mime bench/bench_mime.cpp class_Mime_Table.cpp
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <map>
+#include <string>
+
+#include "../class_Mime_Table.h"
+
+static const char *URIS[] = {
+  "/index.html", "/square0.png", "/square17.png", "/square42.png", "/1.png",
+  "/css/style.css", "/jquery-1.4.3.min.js", "/images/wine3.jpg", "/graphics/doc.gif",
+  "/favicon.ico", "/st.txt", "/files/welcome.html~", "/download.pdf", "/README",
+};
+static const int URI_COUNT = sizeof URIS / sizeof URIS[0];
+
+static double
+now()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static str_ref
+extension(const str_ref &uri)
+{
+  size_t idx = uri.rfind('.');
+  if ( idx == std::string::npos ) return str_ref();
+  return uri.substr(idx);
+}
+
+int
+main(int argc, char **argv)
+{
+  const int ITERATIONS = argc > 1 ? atoi(argv[1]) : 1000000;
+
+  // The types in the shipped ws.conf
+  std::map<std::string, std::string> types;
+  types[".html"] = "text/html";
+  types[".htm"] = "text/html";
+  types[".txt"] = "text/plain";
+  types[".png"] = "image/png";
+  types[".gif"] = "image/gif";
+  types[".jpg"] = "image/jpg";
+  types[".css"] = "text/css";
+  types[".js"] = "text/javascript";
+  types[".ico"] = "image/x-icon";
+
+  Mime_Table table;
+  if ( !table.build(types) )
+  {
+    fprintf(stderr, "couldn't build the table\n");
+    return 1;
+  }
+
+  str_ref uris[URI_COUNT];
+  for (int i = 0; i < URI_COUNT; ++i) uris[i] = URIS[i];
+
+  for (int i = 0; i < URI_COUNT; ++i)
+  {
+    std::map<std::string, std::string>::const_iterator it = types.find(extension(uris[i]).str());
+    str_ref want = it == types.end() ? str_ref() : str_ref(it->second);
+    if ( !table.find(extension(uris[i])).equals(want) )
+    {
+      printf("mismatch for %s\n", URIS[i]);
+      return 1;
+    }
+  }
+
+  volatile size_t sink = 0;
+  printf("%-8s %10s\n", "lookup", "ns/uri");
+
+  double t = now();
+  for (int n = 0; n < ITERATIONS; ++n)
+  {
+    for (int i = 0; i < URI_COUNT; ++i)
+    {
+      std::map<std::string, std::string>::const_iterator it = types.find(extension(uris[i]).str());
+      if ( it != types.end() ) sink += it->second.size();
+    }
+  }
+  printf("%-8s %10.1f\n", "map", (now() - t) * 1e9 / ITERATIONS / URI_COUNT);
+
+  t = now();
+  for (int n = 0; n < ITERATIONS; ++n)
+  {
+    for (int i = 0; i < URI_COUNT; ++i) sink += table.find(extension(uris[i])).len;
+  }
+  printf("%-8s %10.1f\n", "table", (now() - t) * 1e9 / ITERATIONS / URI_COUNT);
+
+  return sink == 0;
+}
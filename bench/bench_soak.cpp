@@ -0,0 +1,234 @@
+// Connection churn soak test: opens and closes connections to a running
+// server as fast as it can and samples the server's resident set size
+// from /proc as it goes, to show that memory stays flat however many
+// connections have come and gone.
+//
+// The connections take turns ending each way the server has to clean
+// up after:
+//   close      a request with "Connection: close", read to EOF
+//   reset      a keep-alive request, then a reset after the first read
+//              while the server may still be writing
+//   idle       connect and hang up without sending anything
+// Prints the RSS samples and a summary as JSON.
+//
+// g++ --std=c++11 -O2 -o bench_soak bench/bench_soak.cpp -lpthread
+//
+// bench_soak --pid <server pid> [--host 127.0.0.1] [--port 8097]
+//            [--connections 1000000] [--parallel 16] [--every 100000]
+//            [--url /st.txt]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+static sockaddr_in server_address;
+static std::string close_request;
+static std::string keep_alive_request;
+static long total_connections = 1000000;
+static std::atomic<long> next_connection(0);
+static std::atomic<long> completed(0);
+static std::atomic<long> failures(0);
+
+static double
+now()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// VmRSS of pid in KiB, or -1
+static long
+rss_kb(int pid)
+{
+  char path[64];
+  snprintf(path, sizeof path, "/proc/%d/status", pid);
+  FILE *f = fopen(path, "r");
+  if ( !f ) return -1;
+  char line[256];
+  long kb = -1;
+  while ( fgets(line, sizeof line, f) )
+  {
+    if ( strncmp(line, "VmRSS:", 6) == 0 )
+    {
+      kb = atol(line + 6);
+      break;
+    }
+  }
+  fclose(f);
+  return kb;
+}
+
+static bool
+send_all(int fd, const std::string &s)
+{
+  size_t off = 0;
+  while ( off < s.size() )
+  {
+    ssize_t n = send(fd, s.data() + off, s.size() - off, MSG_NOSIGNAL);
+    if ( n <= 0 ) return false;
+    off += n;
+  }
+  return true;
+}
+
+// Hang up with a RST, so the client side never sits in TIME_WAIT and
+// the ephemeral ports last for millions of connections
+static void
+reset(int fd)
+{
+  linger l = { 1, 0 };
+  setsockopt(fd, SOL_SOCKET, SO_LINGER, &l, sizeof l);
+  close(fd);
+}
+
+static bool
+one_connection(long n)
+{
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if ( fd < 0 ) return false;
+  if ( connect(fd, reinterpret_cast<sockaddr*>(&server_address), sizeof server_address) != 0 )
+  {
+    close(fd);
+    return false;
+  }
+
+  char buf[16384];
+  bool ok = true;
+  switch ( n % 3 )
+  {
+  case 0:
+    ok = send_all(fd, close_request);
+    while ( ok )
+    {
+      ssize_t r = recv(fd, buf, sizeof buf, 0);
+      if ( r == 0 ) break;
+      if ( r < 0 ) ok = false;
+    }
+    break;
+  case 1:
+    ok = send_all(fd, keep_alive_request) && recv(fd, buf, sizeof buf, 0) > 0;
+    break;
+  default:
+    break;
+  }
+  reset(fd);
+  return ok;
+}
+
+static void*
+churn(void*)
+{
+  for (;;)
+  {
+    long n = next_connection++;
+    if ( n >= total_connections ) break;
+    if ( !one_connection(n) ) ++failures;
+    ++completed;
+  }
+  return NULL;
+}
+
+static void
+usage()
+{
+  fprintf(stderr,
+          "usage: bench_soak --pid n [--host addr] [--port n] [--connections n]\n"
+          "                  [--parallel n] [--every n] [--url /path]\n");
+  exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+  std::string host = "127.0.0.1";
+  int port = 8097;
+  int pid = 0;
+  int parallel = 16;
+  long every = 100000;
+  std::string url = "/st.txt";
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    std::string a = argv[i];
+    const char *v = argv[i+1];
+    if ( a == "--host" ) host = v;
+    else if ( a == "--port" ) port = atoi(v);
+    else if ( a == "--pid" ) pid = atoi(v);
+    else if ( a == "--connections" ) total_connections = atol(v);
+    else if ( a == "--parallel" ) parallel = atoi(v);
+    else if ( a == "--every" ) every = atol(v);
+    else if ( a == "--url" ) url = v;
+    else usage();
+  }
+  if ( argc % 2 == 0 || pid <= 0 || parallel < 1 || every < 1 || rss_kb(pid) < 0 ) usage();
+
+  memset(&server_address, 0, sizeof server_address);
+  server_address.sin_family = AF_INET;
+  server_address.sin_port = htons(port);
+  if ( inet_pton(AF_INET, host.c_str(), &server_address.sin_addr) != 1 ) usage();
+
+  std::string head = "GET " + url + " HTTP/1.1\r\nHost: " + host + "\r\nConnection: ";
+  close_request = head + "close\r\n\r\n";
+  keep_alive_request = head + "keep-alive\r\n\r\n";
+
+  std::vector<pthread_t> threads(parallel);
+  double start = now();
+  for (int i = 0; i < parallel; ++i) pthread_create(&threads[i], NULL, churn, NULL);
+
+  // Sample at every multiple of --every, and once more after the last
+  // connection when the server has had a moment to close it
+  std::vector<long> at;
+  std::vector<long> rss;
+  at.push_back(0);
+  rss.push_back(rss_kb(pid));
+  long next = every;
+  while ( next <= total_connections )
+  {
+    if ( completed.load() >= next )
+    {
+      at.push_back(next);
+      rss.push_back(rss_kb(pid));
+      fprintf(stderr, "%ld connections, %ld KiB\n", next, rss.back());
+      next += every;
+    }
+    else
+    {
+      usleep(10000);
+    }
+  }
+  for (int i = 0; i < parallel; ++i) pthread_join(threads[i], NULL);
+  double elapsed = now() - start;
+  usleep(200000);
+  at.push_back(total_connections);
+  rss.push_back(rss_kb(pid));
+
+  // Growth is judged after the first sample past zero, once the pools
+  // and caches have warmed up
+  size_t warm = at.size() > 2 ? 1 : 0;
+  long max = 0;
+  for (size_t i = 0; i < rss.size(); ++i) if ( rss[i] > max ) max = rss[i];
+
+  printf("{\n");
+  printf("  \"connections\": %ld,\n", total_connections);
+  printf("  \"parallel\": %d,\n", parallel);
+  printf("  \"failures\": %ld,\n", failures.load());
+  printf("  \"connections_per_second\": %.1f,\n", total_connections / elapsed);
+  printf("  \"rss_kb\": {\"start\": %ld, \"warm\": %ld, \"end\": %ld, \"max\": %ld, \"growth_after_warm\": %ld},\n",
+         rss[0], rss[warm], rss.back(), max, rss.back() - rss[warm]);
+  printf("  \"samples\": [");
+  for (size_t i = 0; i < at.size(); ++i)
+  {
+    printf("%s{\"connections\": %ld, \"rss_kb\": %ld}", i ? ", " : "", at[i], rss[i]);
+  }
+  printf("]\n}\n");
+  return 0;
+}
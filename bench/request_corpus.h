@@ -0,0 +1,67 @@
+#ifndef REQUEST_CORPUS_H
+#define REQUEST_CORPUS_H
+
+// Requests recorded from real browsers (and curl) loading the www-Many
+// page, shared by the benchmarks.
+
+#include <stdio.h>
+#include <string>
+
+static const char *CHROME =
+  "GET /square17.png HTTP/1.1\r\n"
+  "Host: localhost:8097\r\n"
+  "Connection: keep-alive\r\n"
+  "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+  "sec-ch-ua-mobile: ?0\r\n"
+  "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+  "sec-ch-ua-platform: \"Linux\"\r\n"
+  "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+  "Sec-Fetch-Site: same-origin\r\n"
+  "Sec-Fetch-Mode: no-cors\r\n"
+  "Sec-Fetch-Dest: image\r\n"
+  "Referer: http://localhost:8097/\r\n"
+  "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+  "Accept-Language: en-US,en;q=0.9\r\n"
+  "\r\n";
+
+static const char *FIREFOX =
+  "GET /square3.png HTTP/1.1\r\n"
+  "Host: localhost:8097\r\n"
+  "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:125.0) Gecko/20100101 Firefox/125.0\r\n"
+  "Accept: image/avif,image/webp,*/*\r\n"
+  "Accept-Language: en-US,en;q=0.5\r\n"
+  "Accept-Encoding: gzip, deflate, br\r\n"
+  "Connection: keep-alive\r\n"
+  "Referer: http://localhost:8097/\r\n"
+  "Sec-Fetch-Dest: image\r\n"
+  "Sec-Fetch-Mode: no-cors\r\n"
+  "Sec-Fetch-Site: same-origin\r\n"
+  "\r\n";
+
+static const char *CURL =
+  "GET /index.html HTTP/1.1\r\n"
+  "Host: localhost:8097\r\n"
+  "User-Agent: curl/8.5.0\r\n"
+  "Accept: */*\r\n"
+  "\r\n";
+
+// What a pipelining client sends for the page's images: count copies
+// of a recorded request, each for the next squareN.png
+inline std::string
+pipelined_batch(const char *recorded, int count)
+{
+  std::string request(recorded);
+  size_t start = request.find(' ') + 1;
+  size_t end = request.find(' ', start);
+
+  std::string batch;
+  for (int i = 0; i < count; ++i)
+  {
+    char uri[32];
+    snprintf(uri, sizeof uri, "/square%d.png", i % 50);
+    batch += request.substr(0, start) + uri + request.substr(end);
+  }
+  return batch;
+}
+
+#endif
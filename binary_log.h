@@ -0,0 +1,108 @@
+#ifndef BINARY_LOG_H
+#define BINARY_LOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// On-disk layout of the binary access log ("AccessLogFormat binary"),
+// shared by the server and mcbride-logcat.
+//
+//   file   := MAGIC entry* [zero bytes]
+//   entry  := SESSION time
+//           | STRING length bytes        next string id, from 0
+//           | STATUS code                next status id, from 0
+//           | RECORD dtime status uri note connection bytes
+//           | DROPPED count
+//
+// Every number is an unsigned LEB128 varint. A SESSION starts over:
+// string and status ids count from 0 again and dtime is relative to
+// its time. In a RECORD, dtime is the zigzag encoded difference in
+// seconds from the previous record (or the session), status is the
+// status id times two plus one if the connection was kept alive, and
+// note is 0 for none or a string id plus one. DROPPED counts the
+// records the server had to drop since the last one it wrote, because
+// the log thread fell behind. A zero tag byte marks the end of the data.
+
+static const char BINARY_LOG_MAGIC[8] = { 'M', 'C', 'B', 'L', 'O', 'G', '1', '\n' };
+
+enum binary_log_tag
+{
+  BL_END = 0,
+  BL_SESSION = 1,
+  BL_STRING = 2,
+  BL_STATUS = 3,
+  BL_RECORD = 4,
+  BL_DROPPED = 5
+};
+
+// The longest a varint can be
+static const size_t VARINT_MAX = 10;
+
+inline uint8_t*
+put_varint(uint8_t *p, uint64_t v)
+{
+  while ( v >= 0x80 )
+  {
+    *p++ = static_cast<uint8_t>(v) | 0x80;
+    v >>= 7;
+  }
+  *p++ = static_cast<uint8_t>(v);
+  return p;
+}
+
+// NULL if the varint runs past end
+inline const uint8_t*
+get_varint(const uint8_t *p, const uint8_t *end, uint64_t &v)
+{
+  v = 0;
+  for (int shift = 0; p < end && shift < 64; shift += 7)
+  {
+    uint8_t b = *p++;
+    v |= static_cast<uint64_t>(b & 0x7f) << shift;
+    if ( !(b & 0x80) ) return p;
+  }
+  return NULL;
+}
+
+inline uint64_t
+zigzag(int64_t v)
+{
+  return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+inline int64_t
+unzigzag(uint64_t v)
+{
+  return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+// Walks past one entry starting at p. Returns the next entry, or NULL at
+// the end marker or when the entry is cut short.
+inline const uint8_t*
+skip_binary_log_entry(const uint8_t *p, const uint8_t *end)
+{
+  if ( p >= end || *p == BL_END ) return NULL;
+  uint64_t v;
+  int numbers;
+  switch ( *p++ )
+  {
+  case BL_SESSION:
+  case BL_STATUS:
+  case BL_DROPPED:
+    numbers = 1;
+    break;
+  case BL_STRING:
+    p = get_varint(p, end, v);
+    if ( !p || v > static_cast<uint64_t>(end - p) ) return NULL;
+    return p + v;
+  case BL_RECORD:
+    numbers = 6;
+    break;
+  default:
+    return NULL;
+  }
+  while ( numbers-- > 0 && p ) p = get_varint(p, end, v);
+  return p;
+}
+
+#endif
@@ -0,0 +1,259 @@
+#include "class_Access_Log.h"
+#include "class_Binary_Log.h"
+#include "http_response.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+/********************************
+*
+* Log_Ring
+*
+********************************/
+
+Log_Ring::Log_Ring():
+    m_head(0),
+    m_tail(0),
+    m_dropped(0)
+{
+}
+
+bool
+Log_Ring::push(const access_record &r)
+{
+  size_t tail = m_tail.load(std::memory_order_relaxed);
+  if ( tail - m_head.load(std::memory_order_acquire) == CAPACITY )
+  {
+    m_dropped.store(m_dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    return false;
+  }
+  m_records[tail & (CAPACITY - 1)] = r;
+  m_tail.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+size_t
+Log_Ring::pop(access_record *out, size_t max)
+{
+  size_t head = m_head.load(std::memory_order_relaxed);
+  size_t n = m_tail.load(std::memory_order_acquire) - head;
+  if ( n > max ) n = max;
+  for (size_t i = 0; i < n; ++i) out[i] = m_records[(head + i) & (CAPACITY - 1)];
+  m_head.store(head + n, std::memory_order_release);
+  return n;
+}
+
+unsigned long
+Log_Ring::dropped() const
+{
+  return m_dropped.load(std::memory_order_relaxed);
+}
+
+/********************************
+*
+* Access_Log
+*
+********************************/
+
+static const size_t FLUSH_BYTES = 64 * 1024;
+static const long IDLE_NS = 10 * 1000 * 1000; // between passes when there was nothing to do
+
+Access_Log::Access_Log():
+    m_fd(-1),
+    m_close_fd(false),
+    m_binary(NULL),
+    m_started(false),
+    m_stop(false),
+    m_written(0),
+    m_dropped_reported(0),
+    m_second(-1)
+{
+  m_stamp[0] = '\0';
+}
+
+Access_Log::~Access_Log()
+{
+  stop();
+  for (size_t i = 0; i < m_rings.size(); ++i) delete m_rings[i];
+  if ( m_close_fd ) close(m_fd);
+  delete m_binary;
+}
+
+bool
+Access_Log::open(const std::string &path, bool binary)
+{
+  if ( binary )
+  {
+    if ( path == "-" ) return false;
+    m_binary = new Binary_Log();
+    return m_binary->open(path);
+  }
+  if ( path == "-" )
+  {
+    m_fd = STDOUT_FILENO;
+    return true;
+  }
+  m_fd = ::open(path.c_str(), O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0644);
+  m_close_fd = m_fd >= 0;
+  return m_fd >= 0;
+}
+
+Log_Ring*
+Access_Log::add_ring()
+{
+  Log_Ring *r = new Log_Ring();
+  m_rings.push_back(r);
+  return r;
+}
+
+bool
+Access_Log::start()
+{
+  m_out.reserve(FLUSH_BYTES + 512);
+  m_started = pthread_create(&m_thread, NULL, run, this) == 0;
+  return m_started;
+}
+
+void
+Access_Log::stop()
+{
+  if ( !m_started ) return;
+  m_stop.store(true, std::memory_order_release);
+  pthread_join(m_thread, NULL);
+  m_started = false;
+  if ( m_binary ) m_binary->close();
+}
+
+unsigned long
+Access_Log::written() const
+{
+  return m_written.load(std::memory_order_relaxed);
+}
+
+unsigned long
+Access_Log::dropped() const
+{
+  unsigned long n = 0;
+  for (size_t i = 0; i < m_rings.size(); ++i) n += m_rings[i]->dropped();
+  return n;
+}
+
+void*
+Access_Log::run(void *self)
+{
+  Access_Log *log = static_cast<Access_Log*>(self);
+  for ( ;; )
+  {
+    bool stopping = log->m_stop.load(std::memory_order_acquire);
+    size_t n = log->drain();
+    if ( stopping ) break;
+    if ( n == 0 )
+    {
+      timespec idle = { 0, IDLE_NS };
+      nanosleep(&idle, NULL);
+    }
+  }
+  return NULL;
+}
+
+// One pass over every ring; returns how many records it wrote
+size_t
+Access_Log::drain()
+{
+  access_record batch[256];
+  size_t total = 0;
+  for (size_t i = 0; i < m_rings.size(); ++i)
+  {
+    size_t n;
+    while ( (n = m_rings[i]->pop(batch, sizeof batch / sizeof batch[0])) > 0 )
+    {
+      for (size_t r = 0; r < n; ++r)
+      {
+        if ( m_binary )
+        {
+          m_binary->append(batch[r]);
+          continue;
+        }
+        format(batch[r]);
+        if ( m_out.size() >= FLUSH_BYTES ) flush();
+      }
+      total += n;
+    }
+  }
+
+  unsigned long lost = dropped();
+  if ( lost != m_dropped_reported )
+  {
+    if ( m_binary )
+    {
+      m_binary->dropped(lost - m_dropped_reported);
+    }
+    else
+    {
+      char digits[20];
+      m_out += "access log overflowed, ";
+      m_out.append(digits, format_decimal(lost - m_dropped_reported, digits));
+      m_out += " records dropped\n";
+    }
+    m_dropped_reported = lost;
+  }
+
+  flush();
+  m_written.store(m_written.load(std::memory_order_relaxed) + total, std::memory_order_relaxed);
+  return total;
+}
+
+// <07:47:00> [05]: <200>: /index.html 3538 ~ (KEEP-ALIVE)
+void
+Access_Log::format(const access_record &r)
+{
+  if ( static_cast<time_t>(r.time) != m_second )
+  {
+    m_second = r.time;
+    tm parts;
+    localtime_r(&m_second, &parts);
+    strftime(m_stamp, sizeof m_stamp, "<%H:%M:%S> ", &parts);
+  }
+
+  char digits[20];
+  m_out += m_stamp;
+  m_out += '[';
+  if ( r.connection >= 0 && r.connection < 10 ) m_out += '0';
+  m_out.append(digits, format_decimal(r.connection, digits));
+  m_out += "]: <";
+  m_out.append(digits, format_decimal(r.status, digits));
+  m_out += ">: ";
+  m_out.append(r.uri, r.uri_len);
+  if ( r.status == 200 || r.status == 206 )
+  {
+    m_out += ' ';
+    m_out.append(digits, format_decimal(r.bytes, digits));
+  }
+  if ( r.note )
+  {
+    if ( r.uri_len ) m_out += ' ';
+    m_out += r.note;
+  }
+  m_out += r.keep_alive ? " ~ (KEEP-ALIVE)\n" : " ~ (CLOSE)\n";
+}
+
+void
+Access_Log::flush()
+{
+  const char *p = m_out.data();
+  size_t left = m_out.size();
+  while ( left > 0 )
+  {
+    ssize_t n = write(m_fd, p, left);
+    if ( n < 0 )
+    {
+      if ( errno == EINTR ) continue;
+      break; // nowhere to report it; the records are lost
+    }
+    p += n;
+    left -= n;
+  }
+  m_out.clear();
+}
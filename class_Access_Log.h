@@ -0,0 +1,102 @@
+#ifndef CLASS_ACCESS_LOG_H
+#define CLASS_ACCESS_LOG_H
+
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "str_ref.h"
+
+class Binary_Log;
+
+// One answered request, as a worker hands it to the access log. Fixed
+// size so it can be copied into a ring without allocating; long URIs
+// are cut short.
+struct access_record
+{
+  static const size_t URI_MAX = 96;
+
+  uint32_t time;       // seconds, by the worker's event loop clock
+  uint16_t status;
+  uint8_t keep_alive;
+  uint8_t uri_len;
+  int32_t connection;  // the socket, as in the other log lines
+  uint64_t bytes;      // body bytes sent
+  const char *note;    // a string literal or NULL
+  char uri[URI_MAX];
+};
+
+// Single producer, single consumer queue of access records: one worker
+// pushes, the log thread pops. Neither side ever waits; a push onto a
+// full ring drops the record and counts it.
+class Log_Ring {
+public:
+  static const size_t CAPACITY = 4096; // records, a power of two
+
+  Log_Ring();
+
+  bool push(const access_record &r);
+  size_t pop(access_record *out, size_t max);
+
+  unsigned long dropped() const;
+
+private:
+  // The indices live on cache lines of their own so the two threads
+  // don't keep stealing each other's line
+  std::atomic<size_t> m_head; // next to pop, written by the consumer
+  char m_pad0[64 - sizeof(std::atomic<size_t>)];
+  std::atomic<size_t> m_tail; // next to push, written by the producer
+  std::atomic<unsigned long> m_dropped;
+  char m_pad1[64 - sizeof(std::atomic<size_t>) - sizeof(std::atomic<unsigned long>)];
+  access_record m_records[CAPACITY];
+};
+
+// Access log written by a background thread. Workers push records into
+// their own Log_Ring; the thread collects them every few milliseconds,
+// formats them in bulk and writes them out in large appends, so a
+// worker never formats, locks or blocks on the disk to log a request.
+class Access_Log {
+public:
+  Access_Log();
+  ~Access_Log();
+
+  // path is a file to append to, or "-" for standard output. A binary
+  // log (see binary_log.h) has to be a file.
+  bool open(const std::string &path, bool binary);
+
+  // One ring per producing thread; all of them before start()
+  Log_Ring* add_ring();
+
+  bool start();
+
+  // Writes out whatever is still queued and stops the thread
+  void stop();
+
+  unsigned long written() const;
+  unsigned long dropped() const;
+
+private:
+  static void* run(void *self);
+  size_t drain();
+  void format(const access_record &r);
+  void flush();
+
+  int m_fd;
+  bool m_close_fd;
+  Binary_Log *m_binary;
+  std::vector<Log_Ring*> m_rings;
+  pthread_t m_thread;
+  bool m_started;
+  std::atomic<bool> m_stop;
+  std::atomic<unsigned long> m_written;
+  unsigned long m_dropped_reported;
+
+  // the log thread's own
+  std::string m_out;
+  time_t m_second;
+  char m_stamp[16];
+};
+
+#endif
@@ -0,0 +1,76 @@
+#include "class_Arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+Arena::Arena(size_t block_size):
+    m_head(NULL),
+    m_used(0),
+    m_retired(0),
+    m_block_size(block_size),
+    m_mallocs(0)
+{
+}
+
+Arena::~Arena()
+{
+  while ( m_head )
+  {
+    block *next = m_head->next;
+    free(m_head);
+    m_head = next;
+  }
+}
+
+void*
+Arena::grow(size_t n, size_t align)
+{
+  size_t size = m_block_size;
+  while ( size < n + align ) size *= 2;
+
+  block *b = static_cast<block*>(malloc(sizeof(block) + size));
+  if ( !b ) throw std::bad_alloc();
+  ++m_mallocs;
+
+  if ( m_head ) m_retired += m_used;
+  b->next = m_head;
+  b->size = size;
+  m_head = b;
+  m_used = 0;
+  return allocate(n, align);
+}
+
+char*
+Arena::concat(const str_ref &a, const str_ref &b)
+{
+  char *s = static_cast<char*>(allocate(a.len + b.len + 1, 1));
+  memcpy(s, a.data, a.len);
+  memcpy(s + a.len, b.data, b.len);
+  s[a.len + b.len] = '\0';
+  return s;
+}
+
+void
+Arena::reset()
+{
+  if ( m_head && m_head->next )
+  {
+    // This batch outgrew the first block. Replace the chain with one
+    // block that would have held all of it.
+    size_t total = m_retired + m_used;
+    while ( m_head )
+    {
+      block *next = m_head->next;
+      free(m_head);
+      m_head = next;
+    }
+    while ( m_block_size < total && m_block_size < MAX_BLOCK_SIZE ) m_block_size *= 2;
+  }
+  m_used = 0;
+  m_retired = 0;
+}
+
+unsigned long
+Arena::mallocs() const
+{
+  return m_mallocs;
+}
@@ -0,0 +1,79 @@
+#ifndef CLASS_ARENA_H
+#define CLASS_ARENA_H
+
+#include <stddef.h>
+#include <new>
+#include "str_ref.h"
+
+// Bump-pointer allocator owned by a connection. Everything built while
+// answering one pipelined batch comes out of it, and reset() throws it
+// all away at once. reset() keeps a single block big enough for the
+// largest batch seen so far, up to MAX_BLOCK_SIZE, so once a connection
+// has warmed up it stops calling malloc altogether. A batch bigger than
+// that still gets its memory, just not a block kept for good.
+//
+// Objects placed in the arena never have their destructors run; only
+// put trivially destructible things in it.
+class Arena {
+public:
+  static const size_t MAX_BLOCK_SIZE = 65536;
+
+  explicit Arena(size_t block_size = 4096);
+  ~Arena();
+
+  void*
+  allocate(size_t n, size_t align = alignof(max_align_t))
+  {
+    size_t p = (m_used + align - 1) & ~(align - 1);
+    if ( !m_head || p + n > m_head->size ) return grow(n, align);
+    m_used = p + n;
+    return m_head->data() + p;
+  }
+
+  template <typename T>
+  T*
+  make()
+  {
+    return new (allocate(sizeof(T), alignof(T))) T();
+  }
+
+  template <typename T, typename A>
+  T*
+  make(const A &a)
+  {
+    return new (allocate(sizeof(T), alignof(T))) T(a);
+  }
+
+  template <typename T, typename A, typename B>
+  T*
+  make(const A &a, const B &b)
+  {
+    return new (allocate(sizeof(T), alignof(T))) T(a, b);
+  }
+
+  // NUL-terminated concatenation of a and b
+  char* concat(const str_ref &a, const str_ref &b = str_ref());
+
+  void reset();
+
+  // Number of times the arena had to go to malloc, ever
+  unsigned long mallocs() const;
+
+private:
+  struct block
+  {
+    block *next;
+    size_t size;
+    char* data() { return reinterpret_cast<char*>(this + 1); }
+  };
+
+  void* grow(size_t n, size_t align);
+
+  block *m_head;       // block being bumped through
+  size_t m_used;       // bytes used in m_head
+  size_t m_retired;    // bytes used in the blocks behind m_head
+  size_t m_block_size;
+  unsigned long m_mallocs;
+};
+
+#endif
@@ -0,0 +1,194 @@
+#include "class_Binary_Log.h"
+#include "class_Access_Log.h"
+#include "binary_log.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+Binary_Log::Binary_Log():
+    m_fd(-1),
+    m_map(NULL),
+    m_map_offset(0),
+    m_end(0),
+    m_in_session(false),
+    m_last_time(0)
+{
+}
+
+Binary_Log::~Binary_Log()
+{
+  close();
+}
+
+bool
+Binary_Log::open(const std::string &path)
+{
+  m_fd = ::open(path.c_str(), O_RDWR|O_CREAT|O_CLOEXEC, 0644);
+  if ( m_fd < 0 ) return false;
+
+  struct stat st;
+  if ( fstat(m_fd, &st) != 0 ) return false;
+  if ( st.st_size == 0 )
+  {
+    if ( !map_at(0) ) return false;
+    memcpy(m_map, BINARY_LOG_MAGIC, sizeof BINARY_LOG_MAGIC);
+    m_end = sizeof BINARY_LOG_MAGIC;
+    return true;
+  }
+
+  m_end = find_end(st.st_size);
+  if ( m_end == 0 ) return false;
+  return map_at(m_end);
+}
+
+// Where the data in an existing file stops, or 0 if it isn't a log
+size_t
+Binary_Log::find_end(size_t size)
+{
+  void *p = mmap(NULL, size, PROT_READ, MAP_SHARED, m_fd, 0);
+  if ( p == MAP_FAILED ) return 0;
+
+  const uint8_t *begin = static_cast<const uint8_t*>(p);
+  const uint8_t *end = begin + size;
+  size_t result = 0;
+  if ( size >= sizeof BINARY_LOG_MAGIC && memcmp(begin, BINARY_LOG_MAGIC, sizeof BINARY_LOG_MAGIC) == 0 )
+  {
+    const uint8_t *at = begin + sizeof BINARY_LOG_MAGIC;
+    while ( const uint8_t *next = skip_binary_log_entry(at, end) ) at = next;
+    result = at - begin;
+  }
+  munmap(p, size);
+  return result;
+}
+
+// Maps CHUNK bytes of the file from the page holding offset, growing the
+// file to cover them
+bool
+Binary_Log::map_at(size_t offset)
+{
+  if ( m_map ) munmap(m_map, CHUNK);
+  m_map = NULL;
+
+  size_t page = sysconf(_SC_PAGESIZE);
+  m_map_offset = offset - offset % page;
+  if ( ftruncate(m_fd, m_map_offset + CHUNK) != 0 ) return false;
+
+  void *p = mmap(NULL, CHUNK, PROT_READ|PROT_WRITE, MAP_SHARED, m_fd, m_map_offset);
+  if ( p == MAP_FAILED ) return false;
+  m_map = static_cast<uint8_t*>(p);
+  return true;
+}
+
+// Room for n more bytes at the end, or NULL if the file can't grow
+uint8_t*
+Binary_Log::reserve(size_t n)
+{
+  if ( !m_map ) return NULL;
+  if ( m_end + n > m_map_offset + CHUNK && !map_at(m_end) ) return NULL;
+  return m_map + (m_end - m_map_offset);
+}
+
+void
+Binary_Log::begin_session(uint32_t time)
+{
+  uint8_t *p = reserve(1 + VARINT_MAX);
+  if ( !p ) return;
+  uint8_t *start = p;
+  *p++ = BL_SESSION;
+  p = put_varint(p, time);
+  m_end += p - start;
+
+  m_strings.clear();
+  m_statuses.clear();
+  m_last_time = time;
+  m_in_session = true;
+}
+
+// The id of a string, writing it out the first time it's seen
+uint64_t
+Binary_Log::intern(const char *s, size_t len)
+{
+  m_key.assign(s, len);
+  std::unordered_map<std::string, uint64_t>::const_iterator it = m_strings.find(m_key);
+  if ( it != m_strings.end() ) return it->second;
+
+  uint8_t *p = reserve(1 + VARINT_MAX + len);
+  if ( !p ) return 0;
+  uint8_t *start = p;
+  *p++ = BL_STRING;
+  p = put_varint(p, len);
+  memcpy(p, s, len);
+  p += len;
+  m_end += p - start;
+
+  uint64_t id = m_strings.size();
+  m_strings[m_key] = id;
+  return id;
+}
+
+uint64_t
+Binary_Log::intern_status(uint16_t code)
+{
+  for (size_t i = 0; i < m_statuses.size(); ++i)
+  {
+    if ( m_statuses[i] == code ) return i;
+  }
+
+  uint8_t *p = reserve(1 + VARINT_MAX);
+  if ( !p ) return 0;
+  uint8_t *start = p;
+  *p++ = BL_STATUS;
+  p = put_varint(p, code);
+  m_end += p - start;
+
+  m_statuses.push_back(code);
+  return m_statuses.size() - 1;
+}
+
+void
+Binary_Log::append(const access_record &r)
+{
+  if ( !m_in_session || m_strings.size() >= MAX_STRINGS ) begin_session(r.time);
+
+  uint64_t status = intern_status(r.status) * 2 + (r.keep_alive ? 1 : 0);
+  uint64_t uri = intern(r.uri, r.uri_len);
+  uint64_t note = r.note ? intern(r.note, strlen(r.note)) + 1 : 0;
+
+  uint8_t *p = reserve(1 + 6 * VARINT_MAX);
+  if ( !p ) return;
+  uint8_t *start = p;
+  *p++ = BL_RECORD;
+  p = put_varint(p, zigzag(static_cast<int64_t>(r.time) - m_last_time));
+  p = put_varint(p, status);
+  p = put_varint(p, uri);
+  p = put_varint(p, note);
+  p = put_varint(p, static_cast<uint32_t>(r.connection));
+  p = put_varint(p, r.bytes);
+  m_end += p - start;
+  m_last_time = r.time;
+}
+
+void
+Binary_Log::dropped(uint64_t count)
+{
+  uint8_t *p = reserve(1 + VARINT_MAX);
+  if ( !p ) return;
+  uint8_t *start = p;
+  *p++ = BL_DROPPED;
+  p = put_varint(p, count);
+  m_end += p - start;
+}
+
+void
+Binary_Log::close()
+{
+  if ( m_fd < 0 ) return;
+  if ( m_map ) munmap(m_map, CHUNK);
+  m_map = NULL;
+  if ( ftruncate(m_fd, m_end) != 0 ) { /* the zero tail is harmless */ }
+  ::close(m_fd);
+  m_fd = -1;
+}
@@ -0,0 +1,54 @@
+#ifndef CLASS_BINARY_LOG_H
+#define CLASS_BINARY_LOG_H
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct access_record;
+
+// Appends access records to a file in the format described in
+// binary_log.h. The file is grown CHUNK bytes at a time and written
+// through a shared mapping, so appending is a memcpy with no syscall;
+// URIs, notes and status codes are written once per session and then
+// referred to by id. Only the access log thread uses it.
+class Binary_Log {
+public:
+  static const size_t CHUNK = 8 << 20;
+  static const size_t MAX_STRINGS = 65536; // per session, then a new one starts
+
+  Binary_Log();
+  ~Binary_Log();
+
+  // Opens or creates path and positions after whatever it holds
+  bool open(const std::string &path);
+  void append(const access_record &r);
+
+  // Notes that count records were dropped before they got here
+  void dropped(uint64_t count);
+
+  // Trims the unused tail of the file and unmaps it
+  void close();
+
+private:
+  uint8_t* reserve(size_t n);
+  bool map_at(size_t offset);
+  size_t find_end(size_t size);
+  void begin_session(uint32_t time);
+  uint64_t intern(const char *s, size_t len);
+  uint64_t intern_status(uint16_t code);
+
+  int m_fd;
+  uint8_t *m_map;
+  size_t m_map_offset; // file offset of m_map, page aligned
+  size_t m_end;        // file offset of the end of the data
+
+  bool m_in_session;
+  uint32_t m_last_time;
+  std::unordered_map<std::string, uint64_t> m_strings;
+  std::vector<uint16_t> m_statuses;
+  std::string m_key; // reused so interning doesn't allocate
+};
+
+#endif
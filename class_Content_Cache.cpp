@@ -0,0 +1,317 @@
+#include "class_Content_Cache.h"
+#include "class_File_Cache.h"
+#include "http_response.h"
+
+#include <event2/buffer.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <functional>
+#include <new>
+
+Content_Cache::Content_Cache(size_t budget, size_t max_object):
+    m_shard_budget(budget / SHARDS),
+    m_max_object(max_object),
+    m_shards(NULL)
+{
+  if ( m_max_object > m_shard_budget ) m_max_object = m_shard_budget;
+  if ( !enabled() ) return;
+
+  m_shards = new shard[SHARDS];
+  for (int i = 0; i < SHARDS; ++i)
+  {
+    shard &s = m_shards[i];
+    pthread_mutex_init(&s.lock, NULL);
+    s.head = s.tail = NULL;
+    s.bytes = 0;
+    memset(&s.freq, 0, sizeof s.freq);
+    memset(&s.counts, 0, sizeof s.counts);
+  }
+}
+
+Content_Cache::~Content_Cache()
+{
+  if ( !m_shards ) return;
+  for (int i = 0; i < SHARDS; ++i)
+  {
+    shard &s = m_shards[i];
+    while ( s.head )
+    {
+      cached_body *b = s.head;
+      unlink(s, b);
+      unref(b);
+    }
+    pthread_mutex_destroy(&s.lock);
+  }
+  delete[] m_shards;
+}
+
+bool
+Content_Cache::enabled() const
+{
+  return m_shard_budget > 0;
+}
+
+/********************************
+*
+* TinyLFU frequency sketch
+*
+********************************/
+
+static inline unsigned
+sketch_index(uint64_t h, int row, int width)
+{
+  // a different 16 bits of a remixed hash per row
+  uint64_t x = h * (0x9E3779B97F4A7C15ull + 2 * row);
+  return (x >> 32) & (width - 1);
+}
+
+void
+Content_Cache::sketch::increment(uint64_t h)
+{
+  for (int r = 0; r < ROWS; ++r)
+  {
+    uint8_t &c = counters[r][sketch_index(h, r, WIDTH)];
+    if ( c < 15 ) ++c;
+  }
+  if ( ++samples >= 10u * WIDTH )
+  {
+    // Age everything so yesterday's hot files can be displaced
+    for (int r = 0; r < ROWS; ++r)
+      for (int i = 0; i < WIDTH; ++i) counters[r][i] >>= 1;
+    samples /= 2;
+  }
+}
+
+unsigned
+Content_Cache::sketch::estimate(uint64_t h) const
+{
+  unsigned m = 15;
+  for (int r = 0; r < ROWS; ++r)
+  {
+    unsigned c = counters[r][sketch_index(h, r, WIDTH)];
+    if ( c < m ) m = c;
+  }
+  return m;
+}
+
+/********************************
+*
+* Cache
+*
+********************************/
+
+const cached_body*
+Content_Cache::get(const cached_file *f)
+{
+  if ( !enabled() || f->size <= 0 || static_cast<size_t>(f->size) > m_max_object ) return NULL;
+
+  uint64_t h = std::hash<std::string>()(f->path);
+  shard &s = m_shards[h % SHARDS];
+
+  pthread_mutex_lock(&s.lock);
+  s.freq.increment(h);
+  std::unordered_map<std::string, cached_body*>::iterator it = s.map.find(f->path);
+  if ( it != s.map.end() )
+  {
+    cached_body *b = it->second;
+    // A reload can change the Content-Type baked into the header tail
+    if ( b->inode == f->inode && b->size == f->size && b->mtime == f->mtime && b->etag == f->etag &&
+         (!b->head_len || b->mime == f->mime) )
+    {
+      ++s.counts.hits;
+      unlink(s, b);
+      push_front(s, b);
+      b->refs.fetch_add(1, std::memory_order_relaxed);
+      pthread_mutex_unlock(&s.lock);
+      return b;
+    }
+    // The file changed on disk since it was cached, or its type did
+    s.map.erase(it);
+    unlink(s, b);
+    s.bytes -= b->charge();
+    ++s.counts.evictions;
+    unref(b);
+  }
+  ++s.counts.misses;
+
+  // Would it get in? Walk back from the least recently used entry until
+  // there's room; the newcomer has to beat every one of those victims.
+  // Its header tail isn't built yet, so this goes by the body alone.
+  size_t need = f->size;
+  unsigned candidate = s.freq.estimate(h);
+  size_t freed = 0;
+  for (cached_body *v = s.tail; v && s.bytes - freed + need > m_shard_budget; v = v->prev)
+  {
+    if ( s.freq.estimate(std::hash<std::string>()(v->path)) >= candidate )
+    {
+      ++s.counts.rejections;
+      pthread_mutex_unlock(&s.lock);
+      return NULL;
+    }
+    freed += v->charge();
+  }
+  pthread_mutex_unlock(&s.lock);
+
+  // Read it outside the lock
+  cached_body *b = load(f);
+  if ( !b ) return NULL;
+
+  pthread_mutex_lock(&s.lock);
+  if ( s.map.count(f->path) )
+  {
+    // Someone else admitted it meanwhile; serve ours once and drop it
+    pthread_mutex_unlock(&s.lock);
+    return b;
+  }
+  while ( s.tail && s.bytes + b->charge() > m_shard_budget )
+  {
+    cached_body *v = s.tail;
+    s.map.erase(v->path);
+    unlink(s, v);
+    s.bytes -= v->charge();
+    ++s.counts.evictions;
+    unref(v);
+  }
+  s.map[b->path] = b;
+  push_front(s, b);
+  s.bytes += b->charge();
+  ++s.counts.admissions;
+  b->refs.fetch_add(1, std::memory_order_relaxed); // the cache's own
+  pthread_mutex_unlock(&s.lock);
+  return b;
+}
+
+cached_body*
+Content_Cache::load(const cached_file *f) const
+{
+  char head[256];
+  str_ref tail;
+  if ( static_cast<size_t>(f->size) <= PRESERIALIZE_MAX )
+  {
+    Header_Builder builder(head, sizeof head);
+    tail = builder.raw(f->validators)
+                  .field("Accept-Ranges", "bytes")
+                  .field("Content-Type", f->mime)
+                  .field("Content-Length", f->size)
+                  .finish();
+    if ( builder.overflowed() ) tail = str_ref();
+  }
+
+  char *block = static_cast<char*>(malloc(tail.len + f->size));
+  if ( !block ) return NULL;
+  memcpy(block, tail.data, tail.len);
+  char *data = block + tail.len;
+
+  size_t done = 0;
+  while ( done < static_cast<size_t>(f->size) )
+  {
+    ssize_t n = pread(f->fd, data + done, f->size - done, done);
+    if ( n <= 0 )
+    {
+      free(block);
+      return NULL;
+    }
+    done += n;
+  }
+
+  cached_body *b = new cached_body();
+  b->path = f->path;
+  b->inode = f->inode;
+  b->size = f->size;
+  b->mtime = f->mtime;
+  b->etag = f->etag;
+  b->block = block;
+  b->head_len = tail.len;
+  if ( tail.len ) b->mime = f->mime;
+  b->data = data;
+  b->len = done;
+  b->refs = 1;
+  b->prev = b->next = NULL;
+  return b;
+}
+
+void
+Content_Cache::release(const cached_body *b)
+{
+  unref(b);
+}
+
+void
+Content_Cache::unref(const cached_body *b)
+{
+  if ( b->refs.fetch_sub(1, std::memory_order_acq_rel) != 1 ) return;
+  free(b->block);
+  delete b;
+}
+
+void
+Content_Cache::cleanup(const void *data, size_t len, void *body)
+{
+  unref(static_cast<const cached_body*>(body));
+}
+
+void
+Content_Cache::add_to_buffer(evbuffer *output, const cached_body *b)
+{
+  add(output, b->data, b->len, b);
+}
+
+void
+Content_Cache::add_response(evbuffer *output, const cached_body *b)
+{
+  add(output, b->block, b->head_len + b->len, b);
+}
+
+void
+Content_Cache::add(evbuffer *output, const char *data, size_t len, const cached_body *b)
+{
+  b->refs.fetch_add(1, std::memory_order_relaxed);
+  if ( evbuffer_add_reference(output, data, len, cleanup, const_cast<cached_body*>(b)) != 0 )
+  {
+    unref(b);
+  }
+}
+
+void
+Content_Cache::unlink(shard &s, cached_body *b)
+{
+  if ( b->prev ) b->prev->next = b->next;
+  else s.head = b->next;
+  if ( b->next ) b->next->prev = b->prev;
+  else s.tail = b->prev;
+  b->prev = b->next = NULL;
+}
+
+void
+Content_Cache::push_front(shard &s, cached_body *b)
+{
+  b->prev = NULL;
+  b->next = s.head;
+  if ( s.head ) s.head->prev = b;
+  s.head = b;
+  if ( !s.tail ) s.tail = b;
+}
+
+Content_Cache::stats
+Content_Cache::totals() const
+{
+  stats t;
+  memset(&t, 0, sizeof t);
+  if ( !enabled() ) return t;
+
+  for (int i = 0; i < SHARDS; ++i)
+  {
+    shard &s = m_shards[i];
+    pthread_mutex_lock(&s.lock);
+    t.hits += s.counts.hits;
+    t.misses += s.counts.misses;
+    t.admissions += s.counts.admissions;
+    t.rejections += s.counts.rejections;
+    t.evictions += s.counts.evictions;
+    t.bytes += s.bytes;
+    t.entries += s.map.size();
+    pthread_mutex_unlock(&s.lock);
+  }
+  return t;
+}
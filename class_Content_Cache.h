@@ -0,0 +1,127 @@
+#ifndef CLASS_CONTENT_CACHE_H
+#define CLASS_CONTENT_CACHE_H
+
+#include <sys/types.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <unordered_map>
+
+struct cached_file;
+
+// A file's contents held in memory. Shared between workers and
+// refcounted, so an entry that is evicted while responses still point
+// at it stays alive until the last of them has been sent.
+//
+// Small files also carry the end of their 200 response: the ETag,
+// Last-Modified, Accept-Ranges, Content-Type and Content-Length lines
+// and the blank line are stored right in front of the body. Only the
+// lines that can differ per request (status, Connection, Date, the
+// lifetime and coding lines) are built for each response, and the rest
+// goes out as one piece.
+struct cached_body
+{
+  std::string path;
+  ino_t inode;
+  off_t size;
+  time_t mtime;
+  std::string etag; // of the file it was read from
+
+  char *block;     // the allocation, header tail and body
+  size_t head_len; // bytes of header tail in front of data, 0 if none
+  std::string mime; // as written into the header tail
+  char *data;      // block + head_len
+  size_t len;
+
+  // What it counts against the cache's budget: body and header tail
+  size_t charge() const { return head_len + len; }
+
+  mutable std::atomic<int> refs;
+  cached_body *prev; // LRU list, most recent first
+  cached_body *next;
+};
+
+// Byte-budgeted LRU cache of small, hot file bodies, served with
+// evbuffer_add_reference so nothing is copied per response.
+//
+// Admission is TinyLFU: every access bumps a count-min sketch of
+// recent popularity, and a file only gets in if it is more popular
+// than everything that would have to be evicted to make room for it.
+// That keeps a scan of one-off files from flushing the hot set.
+class Content_Cache {
+public:
+  static const int SHARDS = 8;
+  static const size_t PRESERIALIZE_MAX = 8192; // bodies up to this get a header tail
+
+  // budget is in bytes for the whole cache; 0 disables it
+  Content_Cache(size_t budget, size_t max_object);
+  ~Content_Cache();
+
+  // The body of f if it is cached or was just admitted, with a
+  // reference the caller has to give back through release(). NULL if
+  // the file isn't cached.
+  const cached_body* get(const cached_file *f);
+  void release(const cached_body *b);
+
+  // Hands a reference on b to an evbuffer; it is released once the
+  // evbuffer is done with the bytes.
+  static void add_to_buffer(struct evbuffer *output, const cached_body *b);
+
+  // The same for the header tail and body together; only valid when
+  // head_len is set.
+  static void add_response(struct evbuffer *output, const cached_body *b);
+
+  bool enabled() const;
+
+  struct stats
+  {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long admissions;
+    unsigned long rejections;
+    unsigned long evictions;
+    size_t bytes;
+    size_t entries;
+  };
+  stats totals() const;
+
+private:
+  // 4-bit count-min sketch, halved every SAMPLE accesses so it tracks
+  // recent rather than all-time popularity
+  struct sketch
+  {
+    static const int WIDTH = 4096; // counters per row
+    static const int ROWS = 4;
+    uint8_t counters[ROWS][WIDTH];
+    unsigned samples;
+
+    void increment(uint64_t h);
+    unsigned estimate(uint64_t h) const;
+  };
+
+  struct shard
+  {
+    pthread_mutex_t lock;
+    std::unordered_map<std::string, cached_body*> map;
+    cached_body *head;
+    cached_body *tail;
+    size_t bytes;
+    sketch freq;
+    stats counts;
+  };
+
+  cached_body* load(const cached_file *f) const;
+  void unlink(shard &s, cached_body *b);
+  void push_front(shard &s, cached_body *b);
+  static void unref(const cached_body *b);
+  static void cleanup(const void *data, size_t len, void *body);
+  static void add(struct evbuffer *output, const char *data, size_t len, const cached_body *b);
+
+  size_t m_shard_budget;
+  size_t m_max_object;
+  shard *m_shards;
+};
+
+#endif
@@ -0,0 +1,421 @@
+#include "class_File_Cache.h"
+#include "class_HTTP_Server.h"
+#include "http_response.h"
+
+#include <event2/buffer.h>
+#include <errno.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+str_ref
+file_extension(const str_ref &filename)
+{
+  size_t idx = filename.rfind('.');
+  if ( idx == std::string::npos ) return str_ref();
+  return filename.substr(idx);
+}
+
+static uint32_t
+fnv1a(const str_ref &s)
+{
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < s.len; ++i)
+  {
+    h ^= static_cast<unsigned char>(s[i]);
+    h *= 16777619u;
+  }
+  return h;
+}
+
+File_Cache::File_Cache(const HTTP_Server *server):
+    m_server(server)
+{
+  for (int i = 0; i < SHARDS; ++i)
+  {
+    pthread_mutex_init(&m_shards[i].lock, NULL);
+    for (int b = 0; b < BUCKETS; ++b) m_shards[i].buckets[b] = NULL;
+    m_shards[i].count = 0;
+    m_shards[i].hits = 0;
+    m_shards[i].misses = 0;
+  }
+}
+
+File_Cache::~File_Cache()
+{
+  clear();
+  for (int i = 0; i < SHARDS; ++i) pthread_mutex_destroy(&m_shards[i].lock);
+}
+
+const cached_file*
+File_Cache::get(const str_ref &uri, time_t now)
+{
+  uint32_t hash = fnv1a(uri);
+  shard &s = m_shards[hash % SHARDS];
+  cached_file **bucket = &s.buckets[(hash / SHARDS) % BUCKETS];
+
+  pthread_mutex_lock(&s.lock);
+  for (cached_file **p = bucket; *p; p = &(*p)->next)
+  {
+    cached_file *f = *p;
+    if ( f->hash != hash || !str_ref(f->uri).equals(uri) ) continue;
+    if ( f->expires <= now )
+    {
+      // Stale, drop it and resolve the path again
+      *p = f->next;
+      --s.count;
+      unref(f);
+      break;
+    }
+    f->refs.fetch_add(1, std::memory_order_relaxed);
+    ++s.hits;
+    pthread_mutex_unlock(&s.lock);
+    return f;
+  }
+  ++s.misses;
+  pthread_mutex_unlock(&s.lock);
+
+  // The syscalls happen outside the lock
+  cached_file *f = load(uri, hash, now);
+  if ( f->expires <= now ) return f; // FileCacheTTL 0
+
+  pthread_mutex_lock(&s.lock);
+  if ( f->config != m_server->config() )
+  {
+    // The config was reloaded meanwhile and invalidate() may already
+    // have been through this shard
+    pthread_mutex_unlock(&s.lock);
+    return f;
+  }
+  for (cached_file *other = *bucket; other; other = other->next)
+  {
+    if ( other->hash == hash && str_ref(other->uri).equals(uri) )
+    {
+      // Another worker got here first, use theirs
+      other->refs.fetch_add(1, std::memory_order_relaxed);
+      pthread_mutex_unlock(&s.lock);
+      unref(f);
+      return other;
+    }
+  }
+  if ( s.count >= MAX_ENTRIES ) purge_expired(s, now);
+  if ( s.count < MAX_ENTRIES )
+  {
+    f->refs.fetch_add(1, std::memory_order_relaxed); // the cache's own
+    f->next = *bucket;
+    *bucket = f;
+    ++s.count;
+  }
+  pthread_mutex_unlock(&s.lock);
+  return f;
+}
+
+void
+File_Cache::release(const cached_file *f)
+{
+  unref(f);
+}
+
+void
+File_Cache::unref(const cached_file *f) const
+{
+  if ( f->refs.fetch_sub(1, std::memory_order_acq_rel) != 1 ) return;
+  for (int c = 0; c < CODINGS; ++c)
+  {
+    if ( f->variants[c] ) unref(f->variants[c]);
+  }
+  if ( f->segment ) evbuffer_file_segment_free(f->segment);
+  delete f;
+}
+
+void
+File_Cache::purge_expired(shard &s, time_t now)
+{
+  for (int b = 0; b < BUCKETS; ++b)
+  {
+    cached_file **p = &s.buckets[b];
+    while ( *p )
+    {
+      cached_file *f = *p;
+      if ( f->expires <= now )
+      {
+        *p = f->next;
+        --s.count;
+        unref(f);
+      }
+      else
+      {
+        p = &f->next;
+      }
+    }
+  }
+}
+
+void
+File_Cache::clear()
+{
+  for (int i = 0; i < SHARDS; ++i)
+  {
+    shard &s = m_shards[i];
+    pthread_mutex_lock(&s.lock);
+    for (int b = 0; b < BUCKETS; ++b)
+    {
+      cached_file *f = s.buckets[b];
+      while ( f )
+      {
+        cached_file *next = f->next;
+        unref(f);
+        f = next;
+      }
+      s.buckets[b] = NULL;
+    }
+    s.count = 0;
+    pthread_mutex_unlock(&s.lock);
+  }
+}
+
+// Whether the outcome of resolving f can differ between two configs
+static bool
+resolves_differently(const cached_file *f, const server_config &before, const server_config &after)
+{
+  if ( before.root != after.root ) return true;
+  if ( f->uri == "/" && before.index_pages != after.index_pages ) return true;
+  if ( f->status == cached_file::NOT_FOUND ) return false;
+  if ( f->status == cached_file::OK && before.precompressed != after.precompressed ) return true;
+  if ( !before.mime_for(f->extension).equals(after.mime_for(f->extension)) ) return true;
+
+  int age_before, age_after;
+  return !before.cache_control_for(f->uri, f->extension, &age_before)
+              .equals(after.cache_control_for(f->uri, f->extension, &age_after));
+}
+
+size_t
+File_Cache::invalidate(const server_config &before, const server_config &after)
+{
+  size_t dropped = 0;
+  for (int i = 0; i < SHARDS; ++i)
+  {
+    shard &s = m_shards[i];
+    pthread_mutex_lock(&s.lock);
+    for (int b = 0; b < BUCKETS; ++b)
+    {
+      cached_file **p = &s.buckets[b];
+      while ( *p )
+      {
+        cached_file *f = *p;
+        if ( resolves_differently(f, before, after) )
+        {
+          *p = f->next;
+          --s.count;
+          ++dropped;
+          unref(f);
+        }
+        else
+        {
+          p = &f->next;
+        }
+      }
+    }
+    pthread_mutex_unlock(&s.lock);
+  }
+  return dropped;
+}
+
+unsigned long
+File_Cache::hits() const
+{
+  unsigned long n = 0;
+  for (int i = 0; i < SHARDS; ++i)
+  {
+    pthread_mutex_lock(&m_shards[i].lock);
+    n += m_shards[i].hits;
+    pthread_mutex_unlock(&m_shards[i].lock);
+  }
+  return n;
+}
+
+unsigned long
+File_Cache::misses() const
+{
+  unsigned long n = 0;
+  for (int i = 0; i < SHARDS; ++i)
+  {
+    pthread_mutex_lock(&m_shards[i].lock);
+    n += m_shards[i].misses;
+    pthread_mutex_unlock(&m_shards[i].lock);
+  }
+  return n;
+}
+
+// Size, mtime and inode from st, and the validators made from them
+static void
+set_stat(cached_file *f, const struct stat &st)
+{
+  f->size = st.st_size;
+  f->mtime = st.st_mtime;
+  f->inode = st.st_ino;
+
+  // The mtime goes in to the nanosecond, so two changes within one
+  // second that leave the size alone still change the ETag
+  char etag[64];
+  snprintf(etag, sizeof etag, "\"%llx-%llx-%llx\"",
+           static_cast<unsigned long long>(st.st_ino),
+           static_cast<unsigned long long>(st.st_size),
+           static_cast<unsigned long long>(st.st_mtim.tv_sec) * 1000000000ull + st.st_mtim.tv_nsec);
+  char date[HTTP_DATE_LEN];
+  format_http_date(st.st_mtime, date);
+  f->etag = etag;
+  f->last_modified.assign(date, HTTP_DATE_LEN);
+  f->validators = "ETag: " + f->etag + "\r\nLast-Modified: " + f->last_modified + "\r\n";
+}
+
+// The sidecar of f compressed with c, or NULL if there is none worth
+// sending: one older than f was made from an earlier version of it,
+// and one that isn't smaller saves nothing
+static cached_file*
+load_variant(const cached_file &f, content_coding c)
+{
+  std::string path = f.path + CODING_NAMES[c].suffix;
+  int fd = open(path.c_str(), O_RDONLY);
+  if ( fd < 0 ) return NULL;
+
+  struct stat st;
+  evbuffer_file_segment *segment = NULL;
+  if ( fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_mtime < f.mtime || st.st_size >= f.size ||
+       !(segment = evbuffer_file_segment_new(fd, 0, st.st_size, EVBUF_FS_CLOSE_ON_FREE)) )
+  {
+    close(fd);
+    return NULL;
+  }
+  VLOG(2) << "Precompressed: " << path;
+
+  cached_file *v = new cached_file();
+  v->status = cached_file::OK;
+  v->uri = f.uri;
+  v->path = path;
+  v->extension = f.extension;
+  v->mime = f.mime;
+  v->segment = segment;
+  v->fd = fd;
+  set_stat(v, st);
+  v->cache_control = f.cache_control;
+  v->max_age = f.max_age;
+  for (int i = 0; i < CODINGS; ++i) v->variants[i] = NULL;
+  v->content_encoding = std::string("Content-Encoding: ") + CODING_NAMES[c].name + "\r\n";
+  v->config = f.config;
+  v->hash = f.hash;
+  v->expires = f.expires;
+  v->refs = 1;
+  v->next = NULL;
+  return v;
+}
+
+// Resolve a URI the way the server always has: "/" means the first
+// DirectoryIndex page that exists, the file has to exist, and its
+// extension has to be one the config allows.
+cached_file*
+File_Cache::load(const str_ref &uri, uint32_t hash, time_t now) const
+{
+  // One snapshot for the whole lookup
+  const server_config *config = m_server->config();
+
+  cached_file *f = new cached_file();
+  f->status = cached_file::NOT_FOUND;
+  f->uri = uri.str();
+  f->segment = NULL;
+  f->fd = -1;
+  f->size = 0;
+  f->mtime = 0;
+  f->inode = 0;
+  f->max_age = -1;
+  for (int c = 0; c < CODINGS; ++c) f->variants[c] = NULL;
+  f->config = config;
+  f->hash = hash;
+  f->expires = now + config->file_cache_ttl;
+  f->refs = 1;
+  f->next = NULL;
+
+  const std::string &root = config->root;
+  str_ref name = uri;
+  int fd = -1;
+
+  if ( uri.equals("/") )
+  {
+    const std::vector<std::string> &index_pages = config->index_pages;
+    for (std::vector<std::string>::const_iterator it = index_pages.begin(); it != index_pages.end(); ++it)
+    {
+      f->path = root + *it;
+      VLOG(2) << "Root file exists? [" << f->path << "]";
+      fd = open(f->path.c_str(), O_RDONLY);
+      if ( fd >= 0 || errno != ENOENT )
+      {
+        name = *it;
+        break;
+      }
+    }
+    if ( fd < 0 && errno == ENOENT ) return f;
+  }
+  else
+  {
+    f->path = root;
+    f->path.append(uri.data, uri.len);
+    fd = open(f->path.c_str(), O_RDONLY);
+    if ( fd < 0 && errno == ENOENT ) return f;
+  }
+
+  str_ref extension = file_extension(name);
+  str_ref mime = config->mime_for(extension);
+  f->extension = extension.str();
+  if ( mime.empty() )
+  {
+    if ( fd >= 0 ) close(fd);
+    f->status = cached_file::NOT_ALLOWED;
+    return f;
+  }
+
+  struct stat st;
+  if ( fd < 0 || fstat(fd, &st) != 0 )
+  {
+    if ( fd >= 0 ) close(fd);
+    f->status = cached_file::OPEN_FAILED;
+    return f;
+  }
+  if ( !S_ISREG(st.st_mode) )
+  {
+    close(fd);
+    return f;
+  }
+
+  f->segment = evbuffer_file_segment_new(fd, 0, st.st_size, EVBUF_FS_CLOSE_ON_FREE);
+  if ( !f->segment )
+  {
+    close(fd);
+    f->status = cached_file::OPEN_FAILED;
+    return f;
+  }
+  f->status = cached_file::OK;
+  f->fd = fd;
+  f->mime = mime.str();
+  set_stat(f, st);
+  f->cache_control = config->cache_control_for(uri, extension, &f->max_age).str();
+
+  if ( config->precompressed )
+  {
+    bool any = false;
+    for (int c = 0; c < CODINGS; ++c)
+    {
+      f->variants[c] = load_variant(*f, static_cast<content_coding>(c));
+      if ( f->variants[c] ) any = true;
+    }
+    if ( any )
+    {
+      f->vary = "Vary: Accept-Encoding\r\n";
+      for (int c = 0; c < CODINGS; ++c)
+      {
+        if ( f->variants[c] ) f->variants[c]->vary = f->vary;
+      }
+    }
+  }
+  return f;
+}
@@ -0,0 +1,135 @@
+#ifndef CLASS_FILE_CACHE_H
+#define CLASS_FILE_CACHE_H
+
+#include <sys/types.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include "str_ref.h"
+
+struct evbuffer_file_segment;
+class HTTP_Server;
+struct server_config;
+
+// Content-Codings a file can have a precompressed sidecar in, in the
+// order they are preferred when the client likes several equally
+enum content_coding
+{
+  CODING_BR,
+  CODING_ZSTD,
+  CODING_GZIP,
+  CODINGS
+};
+
+struct coding_names
+{
+  const char *name;   // as in Accept-Encoding and Content-Encoding
+  const char *suffix; // of the sidecar
+};
+
+static const coding_names CODING_NAMES[CODINGS] = {
+  { "br", ".br" }, { "zstd", ".zst" }, { "gzip", ".gz" }
+};
+
+// What a request URI resolved to on disk. Entries are immutable once
+// they are in the cache and are shared between workers; get() hands out
+// a reference that has to be given back with File_Cache::release().
+struct cached_file
+{
+  enum Status { OK, NOT_FOUND, NOT_ALLOWED, OPEN_FAILED };
+
+  Status status;
+  std::string uri;        // as requested, the cache key
+  std::string path;       // where it resolved to, index page included
+  std::string extension;
+  std::string mime;
+
+  // The open file. libevent refcounts the segment, so responses that
+  // are still being sent keep the descriptor alive after eviction.
+  evbuffer_file_segment *segment;
+  int fd; // owned by segment; for pread()
+  off_t size;
+  time_t mtime;
+  ino_t inode;
+
+  // Validators, formatted once when the file is opened: the ETag (a
+  // strong one, quotes included, from the inode, size and mtime), the
+  // Last-Modified date, and the two header lines for them
+  std::string etag;
+  std::string last_modified;
+  std::string validators;
+
+  // From the config's CacheLifetime lines: the preformatted
+  // Cache-Control line (empty if none applies) and its max-age, which
+  // Expires is worked out from
+  std::string cache_control;
+  int max_age;
+
+  // Precompressed sidecars (file.br and so on, only looked for with
+  // Precompressed on in ws.conf), each a complete entry of its own,
+  // owned by this one and NULL if there is none. A variant has no
+  // variants, and its Content-Encoding line in content_encoding. vary
+  // is the Vary line on every entry of a file that has any variants.
+  cached_file *variants[CODINGS];
+  std::string content_encoding;
+  std::string vary;
+
+  // Cache bookkeeping
+  const server_config *config; // the snapshot it was resolved with
+  uint32_t hash;
+  time_t expires;
+  mutable std::atomic<int> refs;
+  cached_file *next;
+};
+
+// Cache from request URI to open file, size, mime type and the like, so
+// that a hit costs no path syscalls at all. Entries go stale after a
+// fixed number of seconds (FileCacheTTL in ws.conf) and are then
+// resolved again, or sooner if a reload changes how they would resolve.
+// Lookups lock only one of SHARDS shards.
+class File_Cache {
+public:
+  static const int SHARDS = 16;
+  static const int BUCKETS = 256;        // per shard
+  static const size_t MAX_ENTRIES = 512; // per shard
+
+  File_Cache(const HTTP_Server *server);
+  ~File_Cache();
+
+  // now is in seconds, as the event loop last saw it
+  const cached_file* get(const str_ref &uri, time_t now);
+  void release(const cached_file *f);
+
+  void clear();
+
+  // Drops the entries that would resolve differently under after than
+  // they did under before, and returns how many there were
+  size_t invalidate(const server_config &before, const server_config &after);
+
+  unsigned long hits() const;
+  unsigned long misses() const;
+
+private:
+  struct shard
+  {
+    pthread_mutex_t lock;
+    cached_file *buckets[BUCKETS];
+    size_t count;
+    unsigned long hits;
+    unsigned long misses;
+  };
+
+  cached_file* load(const str_ref &uri, uint32_t hash, time_t now) const;
+  void purge_expired(shard &s, time_t now);
+  void unref(const cached_file *f) const;
+
+  const HTTP_Server *m_server;
+  mutable shard m_shards[SHARDS];
+};
+
+// The extension of a file name including the dot, or empty
+str_ref file_extension(const str_ref &filename);
+
+#endif
@@ -0,0 +1,184 @@
+#include "class_HTTP_Parser.h"
+#include "http_scan.h"
+#include <string.h>
+
+HTTP_Parser::HTTP_Parser()
+{
+  reset();
+  m_consumed = 0;
+}
+
+void
+HTTP_Parser::reset()
+{
+  m_state = S_REQUEST_LINE;
+  m_pos = 0;
+  m_start = 0;
+  m_body = 0;
+  m_method.off = m_method.len = 0;
+  m_uri = m_version = m_method;
+  m_header_count = 0;
+  m_error = NULL;
+}
+
+size_t
+HTTP_Parser::consumed() const
+{
+  return m_consumed;
+}
+
+HTTP_Parser::Status
+HTTP_Parser::parse(const char *buf, size_t len, http_message &msg)
+{
+  while ( m_state != S_BODY )
+  {
+    const char *nl = scan_for(buf + m_pos, buf + len, '\n', '\n');
+    if ( nl == buf + len )
+    {
+      if ( len - m_start > MAX_HEADER_BYTES ) return fail("Request header too large.", len, msg);
+      return NEED_MORE;
+    }
+
+    size_t start = m_pos;
+    size_t end = nl - buf;
+    m_pos = end + 1;
+    if ( end > start && buf[end-1] == '\r' ) --end;
+
+    if ( m_pos - m_start > MAX_HEADER_BYTES ) return fail("Request header too large.", m_pos, msg);
+
+    if ( m_state == S_REQUEST_LINE )
+    {
+      // Clients may send stray blank lines between pipelined requests
+      if ( end == start )
+      {
+        m_start = m_pos;
+        continue;
+      }
+      request_line(buf, start, end);
+      m_state = S_HEADERS;
+    }
+    else if ( end == start )
+    {
+      // Blank line: the header block is done
+      if ( !body_length(buf) ) return fail("Invalid Content-Length.", len, msg);
+      m_state = S_BODY;
+    }
+    else
+    {
+      header_line(buf, start, end);
+    }
+  }
+
+  if ( len - m_pos < m_body ) return NEED_MORE;
+
+  m_pos += m_body;
+  fill(buf, msg);
+  m_consumed = m_pos;
+  reset();
+  return COMPLETE;
+}
+
+// A request we can't frame can't be followed by anything we can trust,
+// so it swallows everything that's buffered.
+HTTP_Parser::Status
+HTTP_Parser::fail(const char *error, size_t len, http_message &msg)
+{
+  m_error = error;
+  fill(0, msg);
+  m_consumed = len;
+  reset();
+  return COMPLETE;
+}
+
+void
+HTTP_Parser::request_line(const char *buf, size_t start, size_t end)
+{
+  // METHOD SP URI SP HTTP_VERSION, tolerating runs of spaces
+  span *fields[3] = { &m_method, &m_uri, &m_version };
+  const char *errors[3] = {
+    "Unable to parse HTTP Method.",
+    "Unable to parse HTTP URI.",
+    "Unable to parse HTTP Version."
+  };
+
+  size_t i = start;
+  for (int f = 0; f < 3; ++f)
+  {
+    while ( i < end && buf[i] == ' ' ) ++i;
+    size_t token = i;
+    i = scan_for(buf + i, buf + end, ' ', ' ') - buf;
+    if ( i == token )
+    {
+      if ( !m_error ) m_error = errors[f];
+      return;
+    }
+    fields[f]->off = token;
+    fields[f]->len = i - token;
+  }
+}
+
+void
+HTTP_Parser::header_line(const char *buf, size_t start, size_t end)
+{
+  const char *colon = scan_for(buf + start, buf + end, ':', ':');
+  if ( colon == buf + end || colon == buf + start ) return; // blank key, ignore the line
+
+  if ( m_header_count == http_headers::MAX_HEADERS )
+  {
+    if ( !m_error ) m_error = "Too many headers.";
+    return;
+  }
+
+  size_t name_end = colon - buf;
+  size_t value = name_end + 1;
+  while ( value < end && (buf[value] == ' ' || buf[value] == '\t') ) ++value;
+  while ( end > value && (buf[end-1] == ' ' || buf[end-1] == '\t') ) --end;
+
+  m_names[m_header_count].off = start;
+  m_names[m_header_count].len = name_end - start;
+  m_values[m_header_count].off = value;
+  m_values[m_header_count].len = end - value;
+  ++m_header_count;
+}
+
+bool
+HTTP_Parser::body_length(const char *buf)
+{
+  m_body = 0;
+  for (int i = 0; i < m_header_count; ++i)
+  {
+    str_ref name(buf + m_names[i].off, m_names[i].len);
+    if ( !name.iequals("Content-Length") ) continue;
+
+    str_ref value(buf + m_values[i].off, m_values[i].len);
+    if ( value.empty() ) return false;
+    for (size_t c = 0; c < value.len; ++c)
+    {
+      if ( value[c] < '0' || value[c] > '9' ) return false;
+      m_body = m_body * 10 + (value[c] - '0');
+      if ( m_body > (1u << 30) ) return false;
+    }
+  }
+  return true;
+}
+
+void
+HTTP_Parser::fill(const char *buf, http_message &msg) const
+{
+  msg = http_message();
+  if ( m_error )
+  {
+    msg.isValid = false;
+    msg.error_string = m_error;
+  }
+  if ( !buf ) return;
+
+  msg.method = str_ref(buf + m_method.off, m_method.len);
+  msg.target = str_ref(buf + m_uri.off, m_uri.len);
+  msg.http_version = str_ref(buf + m_version.off, m_version.len);
+  for (int i = 0; i < m_header_count; ++i)
+  {
+    msg.headers.add(str_ref(buf + m_names[i].off, m_names[i].len),
+                    str_ref(buf + m_values[i].off, m_values[i].len));
+  }
+}
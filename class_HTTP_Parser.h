@@ -0,0 +1,77 @@
+#ifndef CLASS_HTTP_PARSER_H
+#define CLASS_HTTP_PARSER_H
+
+#include <stdint.h>
+#include "str_ref.h"
+#include "http_headers.h"
+
+// The parts of an HTTP/1.x request the server cares about. Every view
+// points straight into the connection's input buffer, so a message is
+// only good until that buffer is drained.
+struct http_message
+{
+  http_message(): isValid(true), error_string("") {}
+
+  str_ref method;
+  str_ref target; // the request-target, as sent
+  str_ref http_version;
+  http_headers headers;
+
+  bool isValid;
+  const char *error_string;
+};
+
+// Resumable HTTP/1.x request parser.
+//
+// parse() is handed the bytes of the connection's input buffer starting
+// at the beginning of the request being parsed. When the request isn't
+// all there yet it remembers how far it got and returns NEED_MORE; the
+// next call, with the same start and more bytes behind it, carries on
+// from there instead of rescanning. Nothing is copied or allocated.
+class HTTP_Parser {
+public:
+  enum Status { NEED_MORE, COMPLETE };
+
+  static const size_t MAX_HEADER_BYTES = 16384;
+
+  HTTP_Parser();
+
+  Status parse(const char *buf, size_t len, http_message &msg);
+
+  // Bytes taken up by the request parse() just completed, including any
+  // blank lines before it and its body
+  size_t consumed() const;
+
+  void reset();
+
+private:
+  enum State { S_REQUEST_LINE, S_HEADERS, S_BODY };
+
+  struct span
+  {
+    uint32_t off;
+    uint32_t len;
+  };
+
+  Status fail(const char *error, size_t len, http_message &msg);
+  void request_line(const char *buf, size_t start, size_t end);
+  void header_line(const char *buf, size_t start, size_t end);
+  bool body_length(const char *buf);
+  void fill(const char *buf, http_message &msg) const;
+
+  State m_state;
+  size_t m_pos;       // next byte not yet examined
+  size_t m_start;     // where the request line starts, past blank lines
+  size_t m_body;      // body bytes still to skip
+  size_t m_consumed;
+
+  span m_method;
+  span m_uri;
+  span m_version;
+  span m_names[http_headers::MAX_HEADERS];
+  span m_values[http_headers::MAX_HEADERS];
+  int m_header_count;
+  const char *m_error;
+};
+
+#endif
@@ -1,74 +1,122 @@
 #include "class_HTTP_Server.h"
 #include <sstream>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+#include <unistd.h>
+
+server_config::server_config():
+    port(0),
+    workers(0),
+    reuse_port(false),
+    pin_workers(false),
+    file_cache_ttl(5),
+    precompressed(false),
+    header_timeout(10),
+    keepalive_timeout(10),
+    write_timeout(30),
+    cache_size(0),
+    access_log("-"),
+    access_log_binary(false),
+    status_uri(),
+    root(),
+    index_pages(),
+    mime_types(),
+    prefix_lifetimes()
+{
+}
+
+str_ref
+server_config::mime_for(const str_ref& ext) const
+{
+  return mime_types.find(ext);
+}
+
+str_ref
+server_config::cache_control_for(const str_ref& uri, const str_ref& ext, int *max_age) const
+{
+  for (size_t i = 0; i < prefix_lifetimes.size(); ++i)
+  {
+    if ( uri.starts_with(prefix_lifetimes[i].prefix) )
+    {
+      *max_age = prefix_lifetimes[i].max_age;
+      return prefix_lifetimes[i].cache_control;
+    }
+  }
+  Mime_Table::entry e;
+  if ( !mime_types.lookup(ext, &e) ) e.max_age = -1;
+  *max_age = e.max_age;
+  return e.cache_control;
+}
+
+static bool
+longer_prefix(const prefix_lifetime &a, const prefix_lifetime &b)
+{
+  return a.prefix.size() > b.prefix.size();
+}
 
 HTTP_Server::HTTP_Server():
-    m_index_pages(),
-    m_file_types()
+    m_config(new server_config())
 {
-  pthread_mutex_init(&m_mutex_file_types,NULL);
+}
+
+const server_config*
+HTTP_Server::config() const
+{
+  return m_config.load(std::memory_order_acquire);
 }
 
 int
 HTTP_Server::port() const 
 {
-  return m_port;
+  return config()->port;
 }
 
-std::vector<std::string>
-HTTP_Server::index_pages() const
+int
+HTTP_Server::workers() const
 {
-  return m_index_pages;
+  return config()->workers;
 }
 
-std::string
-HTTP_Server::file_root() const
+bool
+HTTP_Server::reuse_port() const
 {
-  return m_root;
+  return config()->reuse_port;
 }
 
-const std::string
-HTTP_Server::get_mime(const std::string& ext) const
+bool
+HTTP_Server::pin_workers() const
 {
-  std::string mime;
-  pthread_mutex_lock(&m_mutex_file_types);
-  file_map::const_iterator f_it = m_file_types.find(ext);
-  pthread_mutex_unlock(&m_mutex_file_types);
-  return f_it->second;
+  return config()->pin_workers;
 }
 
-bool
-HTTP_Server::extAllowed(const std::string& ext) const
+size_t
+HTTP_Server::cache_size() const
 {
-  pthread_mutex_lock(&m_mutex_file_types);
-  file_map::const_iterator f_it = m_file_types.find(ext);
-  if (f_it == m_file_types.end())
-  {
-    pthread_mutex_unlock(&m_mutex_file_types);
-    return false;
-  }
-  else
-  {
-    pthread_mutex_unlock(&m_mutex_file_types);
-    return true;
-  }
+  return config()->cache_size;
 }
 
-bool  
-HTTP_Server::ParseConfFile(const std::string& filename)
+server_config*
+HTTP_Server::Parse(const std::string& filename) const
 {
   std::ifstream file;
   file.open(filename);
   if ( !file.is_open() )
   {
     LOG(FATAL) << "Error opening file.. : " << filename;
-    return false;
+    return NULL;
   }
 
+  // Parsed into a private copy that is only published once it's complete
+  std::unique_ptr<server_config> c(new server_config());
+  file_map file_types;
+  std::map<std::string, cache_lifetime> lifetimes;
+
   std::string line;
   while ( getline(file, line) )
   {
 
-    if (line.at(0) == '#') continue;
+    if ( line.empty() || line.at(0) == '#' ) continue;
     std::istringstream ss(line);
 
     std::string first;
@@ -79,57 +127,254 @@ HTTP_Server::ParseConfFile(const std::string& filename)
 
     if ( first.compare("Listen") == 0 )
     {
-      if ( !(ss >> m_port) ) {
+      if ( !(ss >> c->port) ) {
         LOG(FATAL) << "Need Listen <int>";
-        return false;
+        return NULL;
+      }
+      LOG(INFO) << "Server port: " << c->port;
+    }
+    else if ( first.compare("Workers") == 0 )
+    {
+      if ( !(ss >> c->workers) || c->workers < 0 ) {
+        LOG(FATAL) << "Need Workers <int>";
+        return NULL;
+      }
+    }
+    else if ( first.compare("ReusePort") == 0 || first.compare("PinWorkers") == 0 ||
+              first.compare("Precompressed") == 0 )
+    {
+      std::string onoff;
+      if ( !(ss >> onoff) || (onoff.compare("on") != 0 && onoff.compare("off") != 0) ) {
+        LOG(FATAL) << "Need " << first << " on|off";
+        return NULL;
+      }
+      bool &flag = first.compare("ReusePort") == 0 ? c->reuse_port
+                 : first.compare("PinWorkers") == 0 ? c->pin_workers
+                 : c->precompressed;
+      flag = onoff.compare("on") == 0;
+      LOG(INFO) << first << ": " << onoff;
+    }
+    else if ( first.compare("FileCacheTTL") == 0 )
+    {
+      if ( !(ss >> c->file_cache_ttl) || c->file_cache_ttl < 0 ) {
+        LOG(FATAL) << "Need FileCacheTTL <seconds>";
+        return NULL;
       }
-      LOG(INFO) << "Server port: " << m_port;
+      LOG(INFO) << "File cache TTL: " << c->file_cache_ttl << "s";
+    }
+    else if ( first.compare("HeaderTimeout") == 0 || first.compare("KeepAliveTimeout") == 0 ||
+              first.compare("WriteTimeout") == 0 )
+    {
+      int &timeout = first.compare("HeaderTimeout") == 0 ? c->header_timeout
+                   : first.compare("KeepAliveTimeout") == 0 ? c->keepalive_timeout
+                   : c->write_timeout;
+      if ( !(ss >> timeout) || timeout < 1 ) {
+        LOG(FATAL) << "Need " << first << " <seconds>, at least 1";
+        return NULL;
+      }
+      LOG(INFO) << first << ": " << timeout << "s";
+    }
+    else if ( first.compare("CacheSize") == 0 )
+    {
+      // bytes, or with a K, M or G suffix
+      unsigned long n;
+      std::string unit;
+      if ( !(ss >> n) ) {
+        LOG(FATAL) << "Need CacheSize <bytes>[K|M|G]";
+        return NULL;
+      }
+      c->cache_size = n;
+      if ( ss >> unit )
+      {
+        if ( unit.compare("K") == 0 ) c->cache_size <<= 10;
+        else if ( unit.compare("M") == 0 ) c->cache_size <<= 20;
+        else if ( unit.compare("G") == 0 ) c->cache_size <<= 30;
+        else {
+          LOG(FATAL) << "Need CacheSize <bytes>[K|M|G]";
+          return NULL;
+        }
+      }
+      LOG(INFO) << "Content cache: " << c->cache_size << " bytes";
+    }
+    else if ( first.compare("AccessLog") == 0 )
+    {
+      if ( !(ss >> c->access_log) ) {
+        LOG(FATAL) << "Need AccessLog <path>|-|off";
+        return NULL;
+      }
+      LOG(INFO) << "Access log: " << c->access_log;
+    }
+    else if ( first.compare("AccessLogFormat") == 0 )
+    {
+      std::string format;
+      if ( !(ss >> format) || (format.compare("text") != 0 && format.compare("binary") != 0) ) {
+        LOG(FATAL) << "Need AccessLogFormat text|binary";
+        return NULL;
+      }
+      c->access_log_binary = format.compare("binary") == 0;
+      LOG(INFO) << "Access log format: " << format;
+    }
+    else if ( first.compare("StatusURI") == 0 )
+    {
+      if ( !(ss >> c->status_uri) || (c->status_uri.at(0) != '/' && c->status_uri.compare("off") != 0) ) {
+        LOG(FATAL) << "Need StatusURI /<path>|off";
+        return NULL;
+      }
+      if ( c->status_uri.compare("off") == 0 ) c->status_uri.clear();
+      LOG(INFO) << "Status page: " << (c->status_uri.empty() ? "off" : c->status_uri);
     }
     else if ( first.compare("DocumentRoot") == 0 )
     {
-      if ( !(ss >> m_root) ) {
+      if ( !(ss >> c->root) ) {
         LOG(FATAL) << "Need DocumentRoot <string>";
-        return false;
+        return NULL;
       }
       // sanitize the dir of quotes
-      m_root.erase(std::remove(m_root.begin(), m_root.end(), '\"'), m_root.end());
-      LOG(INFO) << "Document root: " << m_root;
+      c->root.erase(std::remove(c->root.begin(), c->root.end(), '\"'), c->root.end());
+      LOG(INFO) << "Document root: " << c->root;
     }
     else if ( first.compare("DirectoryIndex") == 0 )
     {
       std::string index;
       if ( !(ss >> index) ) {
         LOG(FATAL) << "Need DirectoryIndex <string> [<string ...]";
-        return false;
+        return NULL;
       }
-      m_index_pages.push_back(index);
+      c->index_pages.push_back(index);
       while ( ss >> index ) {
-        m_index_pages.push_back(index);
+        c->index_pages.push_back(index);
       }
 
       VLOG(1) << "Using directory indices:";
-      for (std::vector<std::string>::iterator it = m_index_pages.begin(); it != m_index_pages.end(); ++it)
+      for (std::vector<std::string>::iterator it = c->index_pages.begin(); it != c->index_pages.end(); ++it)
       {
         VLOG(1) << "\t" << *it;
       }
     }
+    else if ( first.compare("CacheLifetime") == 0 )
+    {
+      // CacheLifetime <.ext|/prefix> <seconds> [immutable]
+      std::string target, flag;
+      cache_lifetime lifetime;
+      if ( !(ss >> target >> lifetime.max_age) || lifetime.max_age < 0 ||
+           (target.at(0) != '.' && target.at(0) != '/') ||
+           ((ss >> flag) && flag.compare("immutable") != 0) ) {
+        LOG(FATAL) << "Need CacheLifetime <.extension|/prefix> <seconds> [immutable]";
+        return NULL;
+      }
+      lifetime.immutable = !flag.empty();
+      if ( target.at(0) == '.' )
+      {
+        std::transform(target.begin(), target.end(), target.begin(), ::tolower);
+        lifetimes[target] = lifetime;
+      }
+      else
+      {
+        prefix_lifetime p;
+        p.prefix = target;
+        p.max_age = lifetime.max_age;
+        p.cache_control = lifetime.header();
+        c->prefix_lifetimes.push_back(p);
+      }
+      LOG(INFO) << "Cache lifetime for " << target << ": " << lifetime.max_age << "s"
+                << (lifetime.immutable ? ", immutable" : "");
+    }
     else if ( first.at(0) == '.' )
     {
+      // Extensions match regardless of case; the type can be left off
+      // for the common ones
+      std::transform(first.begin(), first.end(), first.begin(), ::tolower);
       std::string ct;
       if ( !(ss>> ct) )
       {
-        LOG(ERROR) << "Need \".extension Content-Type\"";
-        LOG(ERROR) << "\t\t[" << line << "]";
-        continue;
+        ct = default_mime(first).str();
+        if ( ct.empty() )
+        {
+          LOG(ERROR) << "Need \".extension Content-Type\"";
+          LOG(ERROR) << "\t\t[" << line << "]";
+          continue;
+        }
       }
-      m_file_types[first] = ct;
+      file_types[first] = ct;
     }
   }
 
-  for (std::map<std::string, std::string>::iterator it = m_file_types.begin(); it != m_file_types.end(); ++it)
+  for (std::map<std::string, std::string>::iterator it = file_types.begin(); it != file_types.end(); ++it)
   {
     VLOG(1) << "Allowed: " << it->first << " (" << it->second << ")";
   }
-  
+  for (std::map<std::string, cache_lifetime>::iterator it = lifetimes.begin(); it != lifetimes.end(); ++it)
+  {
+    if ( !file_types.count(it->first) ) LOG(WARNING) << "CacheLifetime for " << it->first << ", which isn't allowed";
+  }
+  if ( !c->mime_types.build(file_types, lifetimes) )
+  {
+    LOG(FATAL) << "Couldn't build a lookup table for the " << file_types.size() << " allowed extensions";
+    return NULL;
+  }
+  std::stable_sort(c->prefix_lifetimes.begin(), c->prefix_lifetimes.end(), longer_prefix);
+
+  if ( c->access_log_binary && c->access_log == "-" )
+  {
+    LOG(FATAL) << "AccessLogFormat binary needs an AccessLog file";
+    return NULL;
+  }
+
+  // Workers 0 (or no Workers line) means one worker per online CPU
+  if ( c->workers == 0 ) c->workers = sysconf(_SC_NPROCESSORS_ONLN);
+  if ( c->workers < 1 ) c->workers = 1;
+  LOG(INFO) << "Worker threads: " << c->workers;
+
+  return c.release();
+}
+
+bool
+HTTP_Server::ParseConfFile(const std::string& filename)
+{
+  server_config *c = Parse(filename);
+  if ( !c ) return false;
+
+  // Nothing can be reading the old snapshot yet, the workers only start
+  // once the config has been parsed
+  delete m_config.exchange(c, std::memory_order_acq_rel);
   return true;
+}
+
+// Settings the running server was built around; a reload can't change them
+template <typename T>
+static void
+keep_setting(const char *name, T &reloaded, const T &running)
+{
+  if ( reloaded == running ) return;
+  LOG(WARNING) << name << " only changes on restart, keeping " << running;
+  reloaded = running;
+}
+
+const server_config*
+HTTP_Server::Reload(const std::string& filename)
+{
+  // A reload runs in the live server, so whatever goes wrong reading
+  // the file has to leave the running config in place
+  server_config *c;
+  try
+  {
+    c = Parse(filename);
+  }
+  catch ( const std::exception &e )
+  {
+    LOG(ERROR) << "Error reading " << filename << ": " << e.what();
+    return NULL;
+  }
+  if ( !c ) return NULL;
+
+  const server_config *old = config();
+  keep_setting("Listen", c->port, old->port);
+  keep_setting("Workers", c->workers, old->workers);
+  keep_setting("ReusePort", c->reuse_port, old->reuse_port);
+  keep_setting("PinWorkers", c->pin_workers, old->pin_workers);
+  keep_setting("CacheSize", c->cache_size, old->cache_size);
+  keep_setting("AccessLog", c->access_log, old->access_log);
+  keep_setting("AccessLogFormat", c->access_log_binary, old->access_log_binary);
+
+  return m_config.exchange(c, std::memory_order_acq_rel);
 }
\ No newline at end of file
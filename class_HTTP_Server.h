@@ -1,31 +1,81 @@
 #include <vector>
 #include <string>
 #include <map>
-#include <pthread.h>
+#include <atomic>
+#include "str_ref.h"
+#include "class_Mime_Table.h"
+
+// Every translation unit has to agree on this, the workers all log
+#define ELPP_THREAD_SAFE
 #include "easylogging++.h"
 
 typedef std::map<std::string, std::string> file_map;
 
+// A CacheLifetime for every URI under a path prefix
+struct prefix_lifetime
+{
+  std::string prefix;
+  int max_age;
+  std::string cache_control; // the preformatted line
+};
+
+// Everything read from ws.conf. A snapshot is never changed once it has
+// been published, so workers read it without taking any lock.
+struct server_config
+{
+  server_config();
+
+  // The Content-Type for ext, or empty if the extension isn't allowed
+  str_ref mime_for(const str_ref& ext) const;
+
+  // The Cache-Control line for uri, whose extension is ext, and its
+  // max-age in *max_age; empty and -1 if no lifetime applies. A path
+  // prefix wins over the extension, the longest one if several match.
+  str_ref cache_control_for(const str_ref& uri, const str_ref& ext, int *max_age) const;
+
+  int port;
+  int workers;
+  bool reuse_port;
+  bool pin_workers;
+  int file_cache_ttl;
+  bool precompressed;    // serve file.br, file.zst and file.gz to clients that accept them
+  int header_timeout;    // seconds to receive a whole request header, from its first byte
+  int keepalive_timeout; // seconds an idle connection is kept open between requests
+  int write_timeout;     // seconds a response may go without any of it being written
+  size_t cache_size;
+  std::string access_log; // a path, "-" for stdout or "off"
+  bool access_log_binary;
+  std::string status_uri; // empty when the status page is off
+  std::string root;
+  std::vector<std::string> index_pages;
+  Mime_Table mime_types; // with the lifetimes set per extension
+  std::vector<prefix_lifetime> prefix_lifetimes; // longest prefix first
+};
+
 class HTTP_Server {
 public:
   HTTP_Server();
 
   bool ParseConfFile(const std::string& filename);
 
-  int port() const;
-  std::vector<std::string> index_pages() const;
+  // Parses filename again and publishes it as the new snapshot. Returns
+  // the snapshot it replaced, which the caller frees once no worker can
+  // still be using it, or NULL if the file couldn't be parsed (the
+  // current snapshot stays). Settings that need a restart are carried
+  // over from the running config.
+  const server_config* Reload(const std::string& filename);
 
-  std::string file_root() const;
-  const std::string get_mime(const std::string& ext) const;
-
-  bool extAllowed(const std::string& ext) const;
+  // The current snapshot
+  const server_config* config() const;
 
+  int port() const;
+  int workers() const;
+  bool reuse_port() const;
+  bool pin_workers() const;
+  size_t cache_size() const;
 
 private:
-  int m_port;
-  std::string m_root;
-  std::vector<std::string> m_index_pages;
-  file_map m_file_types;
+  server_config* Parse(const std::string& filename) const;
 
-  mutable pthread_mutex_t m_mutex_file_types;
+  std::atomic<const server_config*> m_config;
 };
@@ -0,0 +1,153 @@
+#include "class_Mime_Table.h"
+#include <stdio.h>
+
+str_ref
+default_mime(const str_ref &ext)
+{
+  for (size_t i = 0; i < DEFAULT_MIME_COUNT; ++i)
+  {
+    if ( ext.iequals(DEFAULT_MIME_TYPES[i].extension) ) return DEFAULT_MIME_TYPES[i].type;
+  }
+  return str_ref();
+}
+
+std::string
+cache_lifetime::header() const
+{
+  if ( !set() ) return std::string();
+  char h[64];
+  snprintf(h, sizeof h, "Cache-Control: max-age=%d%s\r\n", max_age, immutable ? ", immutable" : "");
+  return h;
+}
+
+Mime_Table::Mime_Table():
+    m_slots(1),
+    m_mask(0),
+    m_seed(0),
+    m_count(0),
+    m_lifetimes(1)
+{
+}
+
+// FNV-1a over the case folded bytes, mixed with the seed. Only letters
+// are folded, as iequals does; folding every byte would make pairs like
+// ".a[" and ".a{" collide under every seed.
+uint32_t
+Mime_Table::hash(const str_ref &ext, uint32_t seed)
+{
+  uint32_t h = 2166136261u ^ (seed * 0x9E3779B9u);
+  for (size_t i = 0; i < ext.len; ++i)
+  {
+    unsigned char c = ext[i];
+    if ( static_cast<unsigned char>(c - 'A') < 26 ) c |= 0x20;
+    h ^= c;
+    h *= 16777619u;
+  }
+  return h ^ (h >> 15);
+}
+
+bool
+Mime_Table::place(size_t slots, uint32_t seed)
+{
+  m_slots.assign(slots, slot());
+  m_lifetimes.assign(slots, lifetime());
+  m_mask = slots - 1;
+  m_seed = seed;
+
+  for (size_t i = 0; i < m_entries.size(); ++i)
+  {
+    const slot &e = m_entries[i];
+    size_t n = hash(e.extension, seed) & m_mask;
+    slot &s = m_slots[n];
+    if ( s.extension.iequals(e.extension) ) continue; // ".PNG" after ".png", first one wins
+    if ( !s.extension.empty() ) return false;
+    s = e;
+    m_lifetimes[n] = m_entry_lifetimes[i];
+  }
+  return true;
+}
+
+bool
+Mime_Table::build(const std::map<std::string, std::string> &types,
+                  const std::map<std::string, cache_lifetime> &lifetimes)
+{
+  // Lay every string out once so the slots can point at them
+  std::vector<std::string> headers;
+  m_pool.clear();
+  for (std::map<std::string, std::string>::const_iterator it = types.begin(); it != types.end(); ++it)
+  {
+    std::map<std::string, cache_lifetime>::const_iterator l = lifetimes.find(it->first);
+    headers.push_back(l == lifetimes.end() ? std::string() : l->second.header());
+    m_pool += it->first;
+    m_pool += it->second;
+    m_pool += headers.back();
+  }
+  m_count = types.size();
+
+  m_entries.clear();
+  m_entry_lifetimes.clear();
+  const char *p = m_pool.data();
+  size_t i = 0;
+  for (std::map<std::string, std::string>::const_iterator it = types.begin(); it != types.end(); ++it, ++i)
+  {
+    std::map<std::string, cache_lifetime>::const_iterator l = lifetimes.find(it->first);
+    slot s;
+    s.extension = str_ref(p, it->first.size());
+    p += s.extension.len;
+    s.type = str_ref(p, it->second.size());
+    p += s.type.len;
+    lifetime t;
+    t.cache_control = str_ref(p, headers[i].size());
+    p += t.cache_control.len;
+    t.max_age = l == lifetimes.end() ? -1 : l->second.max_age;
+    m_entries.push_back(s);
+    m_entry_lifetimes.push_back(t);
+  }
+
+  // Try seeds at twice the entry count, then at four times and so on;
+  // for the couple of dozen types a config has this ends almost at once
+  size_t slots = 8;
+  while ( slots < 2 * m_count ) slots *= 2;
+  for ( ; slots <= MAX_SLOTS; slots *= 2 )
+  {
+    for (uint32_t seed = 0; seed < 256; ++seed)
+    {
+      if ( !place(slots, seed) ) continue;
+      m_entries.clear();
+      m_entry_lifetimes.clear();
+      return true;
+    }
+  }
+
+  m_entries.clear();
+  m_entry_lifetimes.clear();
+  place(1, 0);
+  m_count = 0;
+  return false;
+}
+
+str_ref
+Mime_Table::find(const str_ref &ext) const
+{
+  const slot &s = m_slots[hash(ext, m_seed) & m_mask];
+  if ( s.extension.empty() || !s.extension.iequals(ext) ) return str_ref();
+  return s.type;
+}
+
+bool
+Mime_Table::lookup(const str_ref &ext, entry *e) const
+{
+  size_t n = hash(ext, m_seed) & m_mask;
+  const slot &s = m_slots[n];
+  if ( s.extension.empty() || !s.extension.iequals(ext) ) return false;
+  e->type = s.type;
+  e->cache_control = m_lifetimes[n].cache_control;
+  e->max_age = m_lifetimes[n].max_age;
+  return true;
+}
+
+size_t
+Mime_Table::size() const
+{
+  return m_count;
+}
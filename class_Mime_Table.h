@@ -0,0 +1,128 @@
+#ifndef CLASS_MIME_TABLE_H
+#define CLASS_MIME_TABLE_H
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "str_ref.h"
+
+// Content-Types for the usual extensions, so ws.conf can allow one by
+// listing just ".png" without spelling out its type.
+struct mime_default
+{
+  const char *extension;
+  const char *type;
+};
+
+constexpr mime_default DEFAULT_MIME_TYPES[] = {
+  { ".html", "text/html" },
+  { ".htm",  "text/html" },
+  { ".txt",  "text/plain" },
+  { ".css",  "text/css" },
+  { ".js",   "text/javascript" },
+  { ".json", "application/json" },
+  { ".xml",  "application/xml" },
+  { ".png",  "image/png" },
+  { ".gif",  "image/gif" },
+  { ".jpg",  "image/jpeg" },
+  { ".jpeg", "image/jpeg" },
+  { ".ico",  "image/x-icon" },
+  { ".svg",  "image/svg+xml" },
+  { ".webp", "image/webp" },
+  { ".pdf",  "application/pdf" },
+  { ".woff2", "font/woff2" },
+};
+
+constexpr size_t DEFAULT_MIME_COUNT = sizeof DEFAULT_MIME_TYPES / sizeof DEFAULT_MIME_TYPES[0];
+
+// The built in type for ext, or empty
+str_ref default_mime(const str_ref &ext);
+
+// How long clients and caches may keep a response, as set by a
+// CacheLifetime line in ws.conf
+struct cache_lifetime
+{
+  cache_lifetime(): max_age(-1), immutable(false) {}
+  cache_lifetime(int age, bool imm): max_age(age), immutable(imm) {}
+
+  bool set() const { return max_age >= 0; }
+
+  // The whole "Cache-Control: ...\r\n" line, empty if it isn't set
+  std::string header() const;
+
+  int max_age; // seconds
+  bool immutable;
+};
+
+// Extension to Content-Type table, built once from the parsed config.
+// An extension can also carry a cache lifetime, whose Cache-Control
+// line is formatted at build time.
+//
+// The slots are a flat power-of-two array and the hash seed is searched
+// for at build time until no two extensions share a slot, so a lookup
+// is one hash, one slot and one compare. Extensions are matched without
+// regard to case, and nothing is allocated.
+class Mime_Table {
+public:
+  // The most slots build() will try before it gives up
+  static const size_t MAX_SLOTS = 1 << 18;
+
+  Mime_Table();
+
+  struct entry
+  {
+    str_ref type;
+    str_ref cache_control; // preformatted line, empty without a lifetime
+    int max_age;           // -1 without a lifetime
+  };
+
+  // types maps extensions (with the dot) to Content-Types, lifetimes
+  // maps some of the same extensions to how long they may be cached.
+  // False if no seed up to MAX_SLOTS slots gives every extension a slot
+  // of its own; the table is then empty.
+  bool build(const std::map<std::string, std::string> &types,
+             const std::map<std::string, cache_lifetime> &lifetimes = std::map<std::string, cache_lifetime>());
+
+  // The Content-Type for ext, or empty if the extension isn't allowed
+  str_ref find(const str_ref &ext) const;
+
+  // Everything known about ext; false if the extension isn't allowed
+  bool lookup(const str_ref &ext, entry *e) const;
+
+  size_t size() const;
+
+private:
+  Mime_Table(const Mime_Table&) = delete;
+  Mime_Table& operator=(const Mime_Table&) = delete;
+
+  // The strings all point into m_pool
+  struct slot
+  {
+    str_ref extension;
+    str_ref type;
+  };
+
+  // Kept apart from the slots, so they stay small for find()
+  struct lifetime
+  {
+    str_ref cache_control;
+    int max_age;
+  };
+
+  static uint32_t hash(const str_ref &ext, uint32_t seed);
+  bool place(size_t slots, uint32_t seed);
+
+  std::vector<slot> m_slots;
+  uint32_t m_mask;
+  uint32_t m_seed;
+  size_t m_count;
+  std::string m_pool;
+  std::vector<lifetime> m_lifetimes; // by slot
+
+  // Only while building: in config order, to be placed into the slots
+  std::vector<slot> m_entries;
+  std::vector<lifetime> m_entry_lifetimes;
+};
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef CLASS_SLAB_POOL_H
+#define CLASS_SLAB_POOL_H
+
+#include <stddef.h>
+#include <vector>
+
+// Objects of one type handed out from slabs of SLAB_OBJECTS. An object
+// that is put back goes on a free list and is handed out again before
+// the pool grows, so under churn the pool stays at the high-water mark
+// of objects in use instead of going back to malloc for every one.
+//
+// Objects are constructed once, when their slab is allocated, and
+// destroyed with the pool; get() and put() don't run constructors, so
+// whatever state an object carries (buffers, events) is there to be
+// reused. Not thread-safe: each pool belongs to one thread.
+template <typename T, size_t SLAB_OBJECTS = 64>
+class Slab_Pool {
+public:
+  Slab_Pool():
+      m_in_use(0)
+  {
+  }
+
+  ~Slab_Pool()
+  {
+    for (size_t i = 0; i < m_slabs.size(); ++i) delete[] m_slabs[i];
+  }
+
+  T*
+  get()
+  {
+    if ( m_free.empty() ) grow();
+    T *t = m_free.back();
+    m_free.pop_back();
+    ++m_in_use;
+    return t;
+  }
+
+  void
+  put(T *t)
+  {
+    m_free.push_back(t);
+    --m_in_use;
+  }
+
+  size_t in_use() const { return m_in_use; }
+  size_t capacity() const { return m_slabs.size() * SLAB_OBJECTS; }
+
+  // Every object the pool holds, handed out or not
+  template <typename F>
+  void
+  for_each(F f)
+  {
+    for (size_t i = 0; i < m_slabs.size(); ++i)
+    {
+      for (size_t j = 0; j < SLAB_OBJECTS; ++j) f(&m_slabs[i][j]);
+    }
+  }
+
+private:
+  Slab_Pool(const Slab_Pool&);
+  Slab_Pool& operator=(const Slab_Pool&);
+
+  void
+  grow()
+  {
+    T *slab = new T[SLAB_OBJECTS];
+    m_slabs.push_back(slab);
+    // Room for every object up front, so put() never allocates
+    m_free.reserve(capacity());
+    for (size_t i = SLAB_OBJECTS; i > 0; --i) m_free.push_back(&slab[i - 1]);
+  }
+
+  std::vector<T*> m_slabs;
+  std::vector<T*> m_free;
+  size_t m_in_use;
+};
+
+#endif
@@ -0,0 +1,112 @@
+#include "class_Timer_Wheel.h"
+
+static inline void
+link_after(wheel_timer *head, wheel_timer *t)
+{
+  t->prev = head;
+  t->next = head->next;
+  head->next->prev = t;
+  head->next = t;
+}
+
+static inline void
+unlink(wheel_timer *t)
+{
+  t->prev->next = t->next;
+  t->next->prev = t->prev;
+  t->prev = t->next = NULL;
+}
+
+Timer_Wheel::Timer_Wheel(uint64_t now):
+    m_now(now),
+    m_size(0)
+{
+  for (int l = 0; l < LEVELS; ++l)
+  {
+    for (int s = 0; s < SLOTS; ++s) m_slots[l][s].prev = m_slots[l][s].next = &m_slots[l][s];
+  }
+}
+
+void
+Timer_Wheel::place(wheel_timer *t)
+{
+  // The highest digit in which the expiry and now differ picks the level
+  uint64_t differ = t->expires ^ m_now;
+  int level = 0;
+  while ( level < LEVELS - 1 && (differ >> (LEVEL_BITS * (level + 1))) != 0 ) ++level;
+  int slot = (t->expires >> (LEVEL_BITS * level)) & (SLOTS - 1);
+  link_after(&m_slots[level][slot], t);
+}
+
+void
+Timer_Wheel::arm(wheel_timer *t, uint64_t expires)
+{
+  if ( t->armed() ) unlink(t);
+  else ++m_size;
+  if ( expires <= m_now ) expires = m_now + 1;
+  if ( expires - m_now > MAX_TICKS ) expires = m_now + MAX_TICKS;
+  t->expires = expires;
+  place(t);
+}
+
+void
+Timer_Wheel::disarm(wheel_timer *t)
+{
+  if ( !t->armed() ) return;
+  unlink(t);
+  --m_size;
+}
+
+// Now has reached this level's current slot: everything in it is due
+// within the span of one slot of the level below, or on this very tick,
+// in which case it lands in the level 0 slot about to fire
+void
+Timer_Wheel::cascade(int level)
+{
+  wheel_timer *head = &m_slots[level][(m_now >> (LEVEL_BITS * level)) & (SLOTS - 1)];
+  while ( head->next != head )
+  {
+    wheel_timer *t = head->next;
+    unlink(t);
+    place(t);
+  }
+}
+
+void
+Timer_Wheel::advance(uint64_t now, fire_fn fire, void *context)
+{
+  while ( m_now < now )
+  {
+    if ( m_size == 0 )
+    {
+      m_now = now;
+      return;
+    }
+
+    ++m_now;
+    // Higher levels first, they may cascade into a lower level's
+    // current slot
+    for (int l = LEVELS - 1; l > 0; --l)
+    {
+      if ( (m_now & ((1ull << (LEVEL_BITS * l)) - 1)) == 0 ) cascade(l);
+    }
+
+    // Detach the due list first, so fire can arm into the wheel freely
+    wheel_timer *slot = &m_slots[0][m_now & (SLOTS - 1)];
+    if ( slot->next == slot ) continue;
+    wheel_timer due;
+    due.prev = slot->prev;
+    due.next = slot->next;
+    due.prev->next = &due;
+    due.next->prev = &due;
+    slot->prev = slot->next = slot;
+
+    while ( due.next != &due )
+    {
+      wheel_timer *t = due.next;
+      unlink(t);
+      --m_size;
+      fire(t, context);
+    }
+  }
+}
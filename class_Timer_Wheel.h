@@ -0,0 +1,71 @@
+#ifndef CLASS_TIMER_WHEEL_H
+#define CLASS_TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A timer lives inside whatever it times out (a connection), so arming
+// and disarming never allocate. It is armed while it is linked into
+// one of the wheel's slots.
+struct wheel_timer
+{
+  wheel_timer(): prev(NULL), next(NULL), expires(0), data(NULL) {}
+
+  bool armed() const { return next != NULL; }
+
+  wheel_timer *prev;
+  wheel_timer *next;
+  uint64_t expires; // tick it fires on
+  void *data;       // for the owner
+};
+
+// Hierarchical timing wheel (Varghese and Lauck). Time is counted in
+// ticks; the owner decides how long a tick is, and every timer that
+// comes due within one tick fires together.
+//
+// There are LEVELS wheels of SLOTS slots. A timer goes in the level of
+// the highest 6-bit digit in which its expiry differs from the current
+// tick, in the slot that digit names. When the current tick reaches a
+// slot of a higher level, its timers are cascaded down into the levels
+// below, so every timer is moved at most LEVELS - 1 times before it
+// fires. Arming, disarming and re-arming are O(1) list operations.
+//
+// Timers further out than SLOTS^LEVELS ticks are clamped to that. Not
+// thread-safe: each worker has its own wheel.
+class Timer_Wheel {
+public:
+  static const int LEVEL_BITS = 6;
+  static const int SLOTS = 1 << LEVEL_BITS;
+  static const int LEVELS = 4;
+  static const uint64_t MAX_TICKS = (1ull << (LEVEL_BITS * LEVELS)) - 1;
+
+  typedef void (*fire_fn)(wheel_timer *t, void *context);
+
+  explicit Timer_Wheel(uint64_t now = 0);
+
+  // Arms t to fire on tick expires, or on the next tick if that has
+  // passed. Re-arms it if it was already armed.
+  void arm(wheel_timer *t, uint64_t expires);
+  void disarm(wheel_timer *t);
+
+  // Moves the wheel on to tick now, calling fire for every timer that
+  // comes due. A timer is disarmed before it fires, and fire is free to
+  // arm or disarm any timer, this one included.
+  void advance(uint64_t now, fire_fn fire, void *context);
+
+  uint64_t now() const { return m_now; }
+  size_t size() const { return m_size; }
+
+private:
+  Timer_Wheel(const Timer_Wheel&);
+  Timer_Wheel& operator=(const Timer_Wheel&);
+
+  void place(wheel_timer *t);
+  void cascade(int level);
+
+  uint64_t m_now;
+  size_t m_size;
+  wheel_timer m_slots[LEVELS][SLOTS]; // list heads
+};
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef HTTP_HEADERS_H
+#define HTTP_HEADERS_H
+
+#include "str_ref.h"
+
+// Headers the server acts on. Each gets a fixed slot in http_headers so
+// looking one up is a single array read.
+enum known_header
+{
+  H_CONNECTION,
+  H_HOST,
+  H_IF_NONE_MATCH,
+  H_RANGE,
+  H_ACCEPT_ENCODING,
+  H_CONTENT_LENGTH,
+  H_IF_MODIFIED_SINCE,
+  H_IF_RANGE,
+  H_KNOWN_COUNT,
+  H_OTHER = -1
+};
+
+// Perfect hash over the known header names: length plus the first and
+// last characters, case folded, into 16 buckets. The static_asserts
+// below keep it collision free as names are added.
+constexpr unsigned
+header_hash(const char *name, size_t len)
+{
+  return (len + (name[0] | 0x20) + (name[len-1] | 0x20)) & 15;
+}
+
+constexpr bool
+header_hashes_to(const char *name, unsigned bucket)
+{
+  return header_hash(name, __builtin_strlen(name)) == bucket;
+}
+
+static_assert(header_hashes_to("Connection", 11), "header hash collision");
+static_assert(header_hashes_to("Host", 0), "header hash collision");
+static_assert(header_hashes_to("If-None-Match", 14), "header hash collision");
+static_assert(header_hashes_to("Range", 12), "header hash collision");
+static_assert(header_hashes_to("Accept-Encoding", 7), "header hash collision");
+static_assert(header_hashes_to("Content-Length", 9), "header hash collision");
+static_assert(header_hashes_to("If-Modified-Since", 15), "header hash collision");
+static_assert(header_hashes_to("If-Range", 6), "header hash collision");
+
+static const char* const KNOWN_HEADER_NAMES[H_KNOWN_COUNT] = {
+  "Connection", "Host", "If-None-Match", "Range", "Accept-Encoding", "Content-Length",
+  "If-Modified-Since", "If-Range"
+};
+
+static const signed char KNOWN_HEADER_BUCKETS[16] = {
+  H_HOST, H_OTHER, H_OTHER, H_OTHER, H_OTHER, H_OTHER, H_IF_RANGE, H_ACCEPT_ENCODING,
+  H_OTHER, H_CONTENT_LENGTH, H_OTHER, H_CONNECTION, H_RANGE, H_OTHER, H_IF_NONE_MATCH, H_IF_MODIFIED_SINCE
+};
+
+inline known_header
+lookup_known_header(const str_ref &name)
+{
+  if ( name.empty() ) return H_OTHER;
+  int h = KNOWN_HEADER_BUCKETS[header_hash(name.data, name.len)];
+  if ( h == H_OTHER || !name.iequals(KNOWN_HEADER_NAMES[h]) ) return H_OTHER;
+  return static_cast<known_header>(h);
+}
+
+struct http_header
+{
+  str_ref name;
+  str_ref value;
+};
+
+// A request's headers, stored inline as views into the buffer they were
+// parsed from. Nothing here allocates.
+class http_headers {
+public:
+  static const int MAX_HEADERS = 32;
+
+  http_headers(): m_count(0) {}
+
+  // false once the table is full
+  bool
+  add(const str_ref &name, const str_ref &value)
+  {
+    if ( m_count == MAX_HEADERS ) return false;
+    m_fields[m_count].name = name;
+    m_fields[m_count].value = value;
+    ++m_count;
+
+    known_header k = lookup_known_header(name);
+    if ( k != H_OTHER && m_known[k].empty() ) m_known[k] = value;
+    return true;
+  }
+
+  const str_ref&
+  get(known_header k) const
+  {
+    return m_known[k];
+  }
+
+  str_ref
+  get(const str_ref &name) const
+  {
+    known_header k = lookup_known_header(name);
+    if ( k != H_OTHER ) return m_known[k];
+    for (int i = 0; i < m_count; ++i)
+    {
+      if ( m_fields[i].name.iequals(name) ) return m_fields[i].value;
+    }
+    return str_ref();
+  }
+
+  int size() const { return m_count; }
+  const http_header& operator[](int i) const { return m_fields[i]; }
+
+private:
+  http_header m_fields[MAX_HEADERS];
+  str_ref m_known[H_KNOWN_COUNT];
+  int m_count;
+};
+
+#endif
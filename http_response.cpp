@@ -0,0 +1,262 @@
+#include "http_response.h"
+#include <string.h>
+#include <sys/time.h>
+#include <event2/event.h>
+
+static const char DAYS[7][4] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+static const char MONTHS[12][4] = {
+  "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+static inline char*
+two_digits(char *p, int v)
+{
+  p[0] = '0' + v / 10;
+  p[1] = '0' + v % 10;
+  return p + 2;
+}
+
+void
+format_http_date(time_t t, char *out)
+{
+  tm gm;
+  gmtime_r(&t, &gm);
+
+  char *p = out;
+  memcpy(p, DAYS[gm.tm_wday], 3); p += 3;
+  *p++ = ','; *p++ = ' ';
+  p = two_digits(p, gm.tm_mday);
+  *p++ = ' ';
+  memcpy(p, MONTHS[gm.tm_mon], 3); p += 3;
+  *p++ = ' ';
+  int year = gm.tm_year + 1900;
+  p = two_digits(p, year / 100);
+  p = two_digits(p, year % 100);
+  *p++ = ' ';
+  p = two_digits(p, gm.tm_hour);
+  *p++ = ':';
+  p = two_digits(p, gm.tm_min);
+  *p++ = ':';
+  p = two_digits(p, gm.tm_sec);
+  memcpy(p, " GMT", 4);
+}
+
+static bool
+read_digits(const char *p, int n, int *v)
+{
+  *v = 0;
+  for (int i = 0; i < n; ++i)
+  {
+    if ( p[i] < '0' || p[i] > '9' ) return false;
+    *v = *v * 10 + (p[i] - '0');
+  }
+  return true;
+}
+
+// Days from 1970-01-01 to the given proleptic Gregorian date
+static int64_t
+days_from_civil(int y, int m, int d)
+{
+  y -= m <= 2;
+  int64_t era = (y >= 0 ? y : y - 399) / 400;
+  int64_t yoe = y - era * 400;
+  int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+bool
+parse_http_date(const str_ref &s, time_t *t)
+{
+  // "Sun, 06 Nov 1994 08:49:37 GMT"
+  if ( s.len != HTTP_DATE_LEN ) return false;
+  const char *p = s.data;
+  if ( p[3] != ',' || p[4] != ' ' || p[7] != ' ' || p[11] != ' ' || p[16] != ' ' ||
+       p[19] != ':' || p[22] != ':' || memcmp(p + 25, " GMT", 4) != 0 ) return false;
+
+  int month = -1;
+  for (int i = 0; i < 12; ++i)
+  {
+    if ( memcmp(p + 8, MONTHS[i], 3) == 0 ) month = i;
+  }
+  int day, year, hour, min, sec;
+  if ( month < 0 || !read_digits(p + 5, 2, &day) || !read_digits(p + 12, 4, &year) ||
+       !read_digits(p + 17, 2, &hour) || !read_digits(p + 20, 2, &min) ||
+       !read_digits(p + 23, 2, &sec) ) return false;
+  if ( day < 1 || day > 31 || hour > 23 || min > 59 || sec > 60 ) return false;
+
+  *t = static_cast<time_t>(days_from_civil(year, month + 1, day) * 86400 + hour * 3600 + min * 60 + sec);
+  return true;
+}
+
+size_t
+format_decimal(uint64_t v, char *out)
+{
+  char tmp[20];
+  size_t n = 0;
+  do {
+    tmp[n++] = '0' + v % 10;
+    v /= 10;
+  } while ( v );
+  for (size_t i = 0; i < n; ++i) out[i] = tmp[n - 1 - i];
+  return n;
+}
+
+/********************************
+*
+* Date_Cache
+*
+********************************/
+
+Date_Cache::Date_Cache():
+    m_base(NULL),
+    m_second(-1),
+    m_later_next(0)
+{
+  m_date[0] = '\0';
+  for (int i = 0; i < LATER_SLOTS; ++i)
+  {
+    m_later[i].seconds = -1;
+    m_later[i].second = -1;
+  }
+}
+
+void
+Date_Cache::attach(event_base *base)
+{
+  m_base = base;
+}
+
+time_t
+Date_Cache::now() const
+{
+  timeval now;
+  if ( !m_base || event_base_gettimeofday_cached(m_base, &now) != 0 ) gettimeofday(&now, NULL);
+  return now.tv_sec;
+}
+
+str_ref
+Date_Cache::get()
+{
+  time_t second = now();
+  if ( second != m_second )
+  {
+    format_http_date(second, m_date);
+    m_date[HTTP_DATE_LEN] = '\0';
+    m_second = second;
+  }
+  return str_ref(m_date, HTTP_DATE_LEN);
+}
+
+str_ref
+Date_Cache::later(int seconds)
+{
+  time_t second = now();
+  later_date *d = NULL;
+  for (int i = 0; i < LATER_SLOTS; ++i)
+  {
+    if ( m_later[i].seconds == seconds )
+    {
+      d = &m_later[i];
+      break;
+    }
+  }
+  if ( !d )
+  {
+    d = &m_later[m_later_next];
+    m_later_next = (m_later_next + 1) % LATER_SLOTS;
+    d->seconds = seconds;
+    d->second = -1;
+  }
+  if ( d->second != second )
+  {
+    format_http_date(second + seconds, d->date);
+    d->second = second;
+  }
+  return str_ref(d->date, HTTP_DATE_LEN);
+}
+
+/********************************
+*
+* Header_Builder
+*
+********************************/
+
+Header_Builder::Header_Builder(char *buf, size_t size):
+    m_buf(buf),
+    m_size(size),
+    m_len(0),
+    m_needed(0),
+    m_overflow(false)
+{
+}
+
+void
+Header_Builder::append(const char *s, size_t n)
+{
+  m_needed += n;
+  if ( m_overflow || m_len + n > m_size )
+  {
+    m_overflow = true;
+    return;
+  }
+  memcpy(m_buf + m_len, s, n);
+  m_len += n;
+}
+
+Header_Builder&
+Header_Builder::status(const str_ref &line)
+{
+  append(line.data, line.len);
+  append("\r\n", 2);
+  return *this;
+}
+
+Header_Builder&
+Header_Builder::field(const str_ref &name, const str_ref &value)
+{
+  append(name.data, name.len);
+  append(": ", 2);
+  append(value.data, value.len);
+  append("\r\n", 2);
+  return *this;
+}
+
+Header_Builder&
+Header_Builder::field(const str_ref &name, uint64_t value)
+{
+  char digits[20];
+  return field(name, str_ref(digits, format_decimal(value, digits)));
+}
+
+Header_Builder&
+Header_Builder::raw(const str_ref &text)
+{
+  append(text.data, text.len);
+  return *this;
+}
+
+str_ref
+Header_Builder::finish()
+{
+  append("\r\n", 2);
+  return str_ref(m_buf, m_len);
+}
+
+str_ref
+Header_Builder::text() const
+{
+  return str_ref(m_buf, m_len);
+}
+
+bool
+Header_Builder::overflowed() const
+{
+  return m_overflow;
+}
+
+size_t
+Header_Builder::needed() const
+{
+  return m_needed;
+}
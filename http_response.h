@@ -0,0 +1,94 @@
+#ifndef HTTP_RESPONSE_H
+#define HTTP_RESPONSE_H
+
+#include <stdint.h>
+#include <time.h>
+#include "str_ref.h"
+
+struct event_base;
+
+// Length of an IMF-fixdate, "Sun, 06 Nov 1994 08:49:37 GMT"
+const size_t HTTP_DATE_LEN = 29;
+
+// Writes the IMF-fixdate for t into out, which must hold HTTP_DATE_LEN
+// bytes. No locale, no iostreams.
+void format_http_date(time_t t, char *out);
+
+// Reads an IMF-fixdate back. The obsolete RFC 850 and asctime forms
+// aren't accepted, so a header in either is as good as absent.
+bool parse_http_date(const str_ref &s, time_t *t);
+
+// Writes v in decimal into out (20 bytes is always enough) and returns
+// the number of digits written, like std::to_chars.
+size_t format_decimal(uint64_t v, char *out);
+
+// The Date header value of one worker. The string is only reformatted
+// the first time it's asked for after the second has changed, and the
+// time comes from the event loop's cached clock, so a hit costs neither
+// a syscall nor any formatting.
+class Date_Cache {
+public:
+  Date_Cache();
+
+  void attach(event_base *base);
+  str_ref get();
+
+  // The current second by the event loop's cached clock
+  time_t now() const;
+
+  // The date seconds from now, for Expires. The last few distinct
+  // values of seconds are kept, each reformatted at most once a second.
+  str_ref later(int seconds);
+
+private:
+  static const int LATER_SLOTS = 4;
+
+  struct later_date
+  {
+    int seconds;
+    time_t second; // when it was formatted
+    char date[HTTP_DATE_LEN];
+  };
+
+  event_base *m_base;
+  time_t m_second;
+  char m_date[HTTP_DATE_LEN + 1];
+  later_date m_later[LATER_SLOTS];
+  int m_later_next; // the slot to reuse next
+};
+
+// Builds a response header into a caller supplied (normally stack)
+// buffer. If the buffer runs out the builder stops writing and
+// overflowed() says so; needed() still counts every byte, so the caller
+// knows how big a buffer to build it again in.
+class Header_Builder {
+public:
+  Header_Builder(char *buf, size_t size);
+
+  Header_Builder& status(const str_ref &line);
+  Header_Builder& field(const str_ref &name, const str_ref &value);
+  Header_Builder& field(const str_ref &name, uint64_t value);
+  Header_Builder& raw(const str_ref &text);
+
+  // Terminates the header block and returns all of it
+  str_ref finish();
+
+  // What has been written so far, unterminated
+  str_ref text() const;
+
+  bool overflowed() const;
+
+  // Bytes the header written so far takes, whether it fit or not
+  size_t needed() const;
+
+private:
+  void append(const char *s, size_t n);
+
+  char *m_buf;
+  size_t m_size;
+  size_t m_len;
+  size_t m_needed;
+  bool m_overflow;
+};
+
+#endif
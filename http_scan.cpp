@@ -0,0 +1,110 @@
+#include "http_scan.h"
+#include <string.h>
+#ifdef HTTP_SCAN_X86
+#include <immintrin.h>
+#endif
+
+const char*
+scan_scalar(const char *p, const char *end, char a, char b)
+{
+  for ( ; p < end; ++p )
+  {
+    if ( *p == a || *p == b ) return p;
+  }
+  return end;
+}
+
+#ifdef HTTP_SCAN_X86
+
+// pcmpestri compares 16 bytes of input against a set of up to 16
+// characters in one instruction.
+__attribute__((target("sse4.2")))
+const char*
+scan_sse42(const char *p, const char *end, char a, char b)
+{
+  const __m128i set = _mm_setr_epi8(a, b, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+  for ( ; end - p >= 16; p += 16 )
+  {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    int idx = _mm_cmpestri(set, 2, chunk, 16,
+                           _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+    if ( idx < 16 ) return p + idx;
+  }
+  return scan_scalar(p, end, a, b);
+}
+
+__attribute__((target("avx2,bmi")))
+const char*
+scan_avx2(const char *p, const char *end, char a, char b)
+{
+  const __m256i va = _mm256_set1_epi8(a);
+  const __m256i vb = _mm256_set1_epi8(b);
+  for ( ; end - p >= 32; p += 32 )
+  {
+    __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, va), _mm256_cmpeq_epi8(chunk, vb));
+    unsigned mask = _mm256_movemask_epi8(hit);
+    if ( mask ) return p + _tzcnt_u32(mask);
+  }
+  if ( end - p >= 16 )
+  {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm256_castsi256_si128(va)),
+                               _mm_cmpeq_epi8(chunk, _mm256_castsi256_si128(vb)));
+    unsigned mask = _mm_movemask_epi8(hit);
+    if ( mask ) return p + _tzcnt_u32(mask);
+    p += 16;
+  }
+  return scan_scalar(p, end, a, b);
+}
+
+#endif // HTTP_SCAN_X86
+
+static scan_fn
+scan_detect()
+{
+#ifdef HTTP_SCAN_X86
+  __builtin_cpu_init();
+  if ( __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi") ) return scan_avx2;
+  if ( __builtin_cpu_supports("sse4.2") ) return scan_sse42;
+#endif
+  return scan_scalar;
+}
+
+scan_fn scan_for_impl = scan_detect();
+
+const char*
+scan_impl_name()
+{
+#ifdef HTTP_SCAN_X86
+  if ( scan_for_impl == scan_avx2 ) return "avx2";
+  if ( scan_for_impl == scan_sse42 ) return "sse4.2";
+#endif
+  return "scalar";
+}
+
+bool
+scan_select(const char *name)
+{
+  if ( strcmp(name, "scalar") == 0 )
+  {
+    scan_for_impl = scan_scalar;
+    return true;
+  }
+#ifdef HTTP_SCAN_X86
+  __builtin_cpu_init();
+  if ( strcmp(name, "avx2") == 0 )
+  {
+    if ( !__builtin_cpu_supports("avx2") || !__builtin_cpu_supports("bmi") ) return false;
+    scan_for_impl = scan_avx2;
+    return true;
+  }
+  if ( strcmp(name, "sse4.2") == 0 )
+  {
+    if ( !__builtin_cpu_supports("sse4.2") ) return false;
+    scan_for_impl = scan_sse42;
+    return true;
+  }
+#endif
+  return false;
+}
@@ -0,0 +1,40 @@
+#ifndef HTTP_SCAN_H
+#define HTTP_SCAN_H
+
+#include <stddef.h>
+
+// Delimiter scanning for the request parser.
+//
+// scan_for() returns the first byte in [p, end) that equals a or b, or
+// end if there is none. Pass the same character twice to look for just
+// one. The implementation (AVX2, SSE4.2 or plain byte-at-a-time) is
+// picked once from the CPU the server is running on. Off x86 only the
+// byte-at-a-time one is built.
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HTTP_SCAN_X86 1
+#endif
+
+typedef const char* (*scan_fn)(const char *p, const char *end, char a, char b);
+
+const char* scan_scalar(const char *p, const char *end, char a, char b);
+#ifdef HTTP_SCAN_X86
+const char* scan_sse42(const char *p, const char *end, char a, char b);
+const char* scan_avx2(const char *p, const char *end, char a, char b);
+#endif
+
+extern scan_fn scan_for_impl;
+
+inline const char*
+scan_for(const char *p, const char *end, char a, char b)
+{
+  return scan_for_impl(p, end, a, b);
+}
+
+// "avx2", "sse4.2" or "scalar"
+const char* scan_impl_name();
+
+// Override the runtime choice (benchmarks); false if the CPU can't run it
+bool scan_select(const char *name);
+
+#endif
@@ -0,0 +1,512 @@
+#include "request_handling.h"
+#include "class_HTTP_Server.h"
+#include "class_File_Cache.h"
+#include <event2/buffer.h>
+#include <string.h>
+#include <algorithm>
+
+str_ref
+MakeError(Arena &arena, const str_ref &status, const str_ref &what, const str_ref &detail)
+{
+  size_t len = status.len + what.len + detail.len + 2;
+  char *es = static_cast<char*>(arena.allocate(len, 1));
+  char *p = es;
+  memcpy(p, status.data, status.len); p += status.len;
+  memcpy(p, what.data, what.len); p += what.len;
+  memcpy(p, detail.data, detail.len); p += detail.len;
+  memcpy(p, "\n\n", 2);
+  return str_ref(es, len);
+}
+
+str_ref
+Make400(Arena &arena, const str_ref &problem, const str_ref &req)
+{
+  return MakeError(arena, "HTTP/1.1 400 Bad Request: ", problem, req);
+}
+
+str_ref
+Make404(Arena &arena, const str_ref &file)
+{
+  return MakeError(arena, "HTTP/1.1 404 Not Found: ", file);
+}
+
+str_ref
+Make500()
+{
+  return str_ref("HTTP/1.1 500 Internal Server Error: cannot allocate memory\n");
+}
+
+str_ref
+Make501(Arena &arena, const str_ref &file)
+{
+  return MakeError(arena, "HTTP/1.1 501 Not Implemented: ", file);
+}
+
+// Parse every complete request sitting in the input buffer in one pass.
+// The requests point into the buffer, so the caller drains the returned
+// number of bytes only once it has answered them. A request that isn't
+// all there yet stays in the buffer, and the connection's parser picks it
+// up where it left off on the next read. The requests themselves are
+// linked together in the connection's arena.
+size_t
+CreateRequests(evbuffer *input, HTTP_Parser &parser, Arena &arena, const char *tag, http_request **requests)
+{
+  *requests = NULL;
+
+  size_t total = evbuffer_get_length(input);
+  if ( total == 0 ) return 0;
+
+  // Normally everything is in the first chain. Only when a request
+  // straddles two reads does the buffer need to be made contiguous.
+  evbuffer_iovec vec;
+  if ( evbuffer_peek(input, -1, NULL, &vec, 1) < 1 ) return 0;
+  const char *data = static_cast<const char*>(vec.iov_base);
+  if ( vec.iov_len < total )
+  {
+    VLOG(3) << tag << "Request spans " << vec.iov_len << "/" << total << " bytes, pulling up";
+    data = reinterpret_cast<const char*>(evbuffer_pullup(input, total));
+  }
+
+  size_t offset = 0;
+  int count = 0;
+  http_request **tail = requests;
+  http_request *req = arena.make<http_request>();
+  while ( offset < total &&
+          parser.parse(data + offset, total - offset, *req) == HTTP_Parser::COMPLETE )
+  {
+    offset += parser.consumed();
+    *tail = req;
+    tail = &req->next;
+    ++count;
+
+    if ( !req->isValid ) {
+      LOG(WARNING) << tag << req->error_string;
+    }
+    else {
+      req->uri_set(req->target);
+      VLOG(2) << tag << "req.method= " << req->method.str();
+      VLOG(2) << tag << "req.uri= " << req->target.str();
+      VLOG(2) << tag << "req.http_version= " << req->http_version.str();
+      for (int i = 0; i < req->headers.size(); ++i)
+      {
+        VLOG(3) << tag << "req.headers[" << req->headers[i].name.str() << "]= " << req->headers[i].value.str();
+      }
+    }
+    req = arena.make<http_request>();
+  }
+
+  VLOG(3) << "Total pipelined requests: " << count;
+  return offset;
+}
+
+static inline bool
+is_space(char c)
+{
+  return c == ' ' || c == '\t';
+}
+
+// If-None-Match is "*" or a comma separated list of entity tags, each
+// maybe marked weak with "W/". A GET compares them weakly, so the mark
+// doesn't matter.
+static bool
+etag_listed(const str_ref &list, const str_ref &etag)
+{
+  size_t i = 0;
+  while ( i < list.len )
+  {
+    while ( i < list.len && (is_space(list[i]) || list[i] == ',') ) ++i;
+    if ( i == list.len ) break;
+    if ( list[i] == '*' ) return true;
+    if ( list.len - i > 2 && list[i] == 'W' && list[i+1] == '/' ) i += 2;
+
+    size_t start = i;
+    if ( list[i] == '"' )
+    {
+      ++i;
+      while ( i < list.len && list[i] != '"' ) ++i;
+      if ( i < list.len ) ++i;
+    }
+    else
+    {
+      // Not a valid tag, skip it
+      while ( i < list.len && list[i] != ',' ) ++i;
+      continue;
+    }
+    if ( list.substr(start, i - start).equals(etag) ) return true;
+  }
+  return false;
+}
+
+bool
+NotModified(const http_request &req, const cached_file &f)
+{
+  const str_ref &none_match = req.headers.get(H_IF_NONE_MATCH);
+  if ( !none_match.empty() ) return etag_listed(none_match, f.etag);
+
+  const str_ref &since = req.headers.get(H_IF_MODIFIED_SINCE);
+  if ( since.empty() ) return false;
+  // Browsers send back the Last-Modified they were given, so that's
+  // checked before any date gets parsed
+  if ( since.equals(f.last_modified) ) return true;
+  time_t t;
+  return parse_http_date(since, &t) && f.mtime <= t;
+}
+
+// Digits up to the next non-digit; false if there are none or too many
+static bool
+read_position(const str_ref &s, size_t &i, uint64_t *v)
+{
+  size_t start = i;
+  *v = 0;
+  while ( i < s.len && s[i] >= '0' && s[i] <= '9' )
+  {
+    if ( i - start == 18 ) return false;
+    *v = *v * 10 + (s[i] - '0');
+    ++i;
+  }
+  return i > start;
+}
+
+static bool
+earlier_range(const byte_range &a, const byte_range &b)
+{
+  return a.first < b.first;
+}
+
+// If-Range holds either an entity tag, which has to be the file's own
+// (a strong comparison, so a weak tag never matches), or a date, which
+// has to be exactly its Last-Modified
+static bool
+if_range_matches(const str_ref &validator, const cached_file &f)
+{
+  if ( validator.starts_with("\"") || validator.starts_with("W/") ) return validator.equals(f.etag);
+  return validator.equals(f.last_modified);
+}
+
+int
+RequestedRanges(const http_request &req, const cached_file &f, byte_range *ranges)
+{
+  const str_ref &range = req.headers.get(H_RANGE);
+  if ( range.len < 6 || !range.substr(0, 6).iequals("bytes=") ) return -1;
+  const str_ref &if_range = req.headers.get(H_IF_RANGE);
+  if ( !if_range.empty() && !if_range_matches(if_range, f) ) return -1;
+
+  uint64_t size = f.size;
+  int count = 0;
+  int asked = 0;
+  size_t i = 6;
+  for ( ;; )
+  {
+    // Empty list elements are allowed
+    while ( i < range.len && (is_space(range[i]) || range[i] == ',') ) ++i;
+    if ( i == range.len ) break;
+    if ( ++asked > MAX_RANGES ) return -1;
+
+    // Ranges that start past the end are left out
+    uint64_t first, last;
+    if ( range[i] == '-' )
+    {
+      // The last n bytes
+      ++i;
+      uint64_t n;
+      if ( !read_position(range, i, &n) ) return -1;
+      if ( n > 0 && size > 0 )
+      {
+        ranges[count].first = n < size ? size - n : 0;
+        ranges[count++].last = size - 1;
+      }
+    }
+    else
+    {
+      if ( !read_position(range, i, &first) || i == range.len || range[i] != '-' ) return -1;
+      ++i;
+      bool open_ended = i == range.len || range[i] == ',' || is_space(range[i]);
+      if ( open_ended ) last = size - 1;
+      else if ( !read_position(range, i, &last) || last < first ) return -1;
+      if ( first < size )
+      {
+        ranges[count].first = first;
+        ranges[count++].last = last < size ? last : size - 1;
+      }
+    }
+
+    while ( i < range.len && is_space(range[i]) ) ++i;
+    if ( i < range.len && range[i] != ',' ) return -1;
+  }
+  if ( asked == 0 ) return -1;
+
+  // Overlapping ranges would have the same bytes sent more than once
+  std::sort(ranges, ranges + count, earlier_range);
+  int merged = 0;
+  for (int k = 0; k < count; ++k)
+  {
+    if ( merged > 0 && ranges[k].first <= ranges[merged - 1].last + 1 )
+    {
+      if ( ranges[k].last > ranges[merged - 1].last ) ranges[merged - 1].last = ranges[k].last;
+    }
+    else
+    {
+      ranges[merged++] = ranges[k];
+    }
+  }
+  return merged;
+}
+
+// A q-value in thousandths: "1", "0", "0.5", "1.000"; -1 if it isn't one
+static int
+read_qvalue(const str_ref &s)
+{
+  if ( s.empty() || (s[0] != '0' && s[0] != '1') ) return -1;
+  int q = (s[0] - '0') * 1000;
+  if ( s.len == 1 ) return q;
+  if ( s[1] != '.' || s.len > 5 ) return -1;
+  int scale = 100;
+  for (size_t i = 2; i < s.len; ++i, scale /= 10)
+  {
+    if ( s[i] < '0' || s[i] > '9' ) return -1;
+    q += (s[i] - '0') * scale;
+  }
+  return q > 1000 ? -1 : q;
+}
+
+const cached_file&
+Negotiate(const http_request &req, const cached_file &f)
+{
+  // Only a file with variants has anything to negotiate
+  if ( f.vary.empty() ) return f;
+  const str_ref &accept = req.headers.get(H_ACCEPT_ENCODING);
+  if ( accept.empty() ) return f;
+
+  // "gzip, deflate, br;q=0.9, *;q=0.1": a coding that isn't listed
+  // gets the q-value of "*", or 0, except identity, which gets 1
+  int q[CODINGS];
+  for (int c = 0; c < CODINGS; ++c) q[c] = -1;
+  int any = -1;
+  int identity = -1;
+  size_t i = 0;
+  while ( i < accept.len )
+  {
+    while ( i < accept.len && (is_space(accept[i]) || accept[i] == ',') ) ++i;
+    size_t start = i;
+    while ( i < accept.len && accept[i] != ',' && accept[i] != ';' && !is_space(accept[i]) ) ++i;
+    str_ref name = accept.substr(start, i - start);
+
+    int value = 1000;
+    while ( i < accept.len && accept[i] != ',' )
+    {
+      if ( accept[i] == ';' )
+      {
+        ++i;
+        while ( i < accept.len && is_space(accept[i]) ) ++i;
+        start = i;
+        while ( i < accept.len && accept[i] != ',' && accept[i] != ';' && !is_space(accept[i]) ) ++i;
+        str_ref param = accept.substr(start, i - start);
+        if ( param.len > 2 && (param[0] | 0x20) == 'q' && param[1] == '=' ) value = read_qvalue(param.substr(2));
+      }
+      else
+      {
+        ++i;
+      }
+    }
+    if ( value < 0 || name.empty() ) continue;
+
+    if ( name.equals("*") ) any = value;
+    else if ( name.iequals("identity") ) identity = value;
+    else if ( name.iequals("x-gzip") ) q[CODING_GZIP] = value;
+    for (int c = 0; c < CODINGS; ++c)
+    {
+      if ( name.iequals(CODING_NAMES[c].name) ) q[c] = value;
+    }
+  }
+
+  // A variant has to beat the file itself, which it can only do on
+  // size when the client rates them the same
+  const cached_file *best = &f;
+  int best_q = identity >= 0 ? identity : any >= 0 ? any : 1000;
+  for (int c = 0; c < CODINGS; ++c)
+  {
+    const cached_file *v = f.variants[c];
+    int qc = q[c] >= 0 ? q[c] : any >= 0 ? any : 0;
+    if ( !v || qc == 0 ) continue;
+    if ( qc > best_q || (qc == best_q && v->size < best->size) )
+    {
+      best = v;
+      best_q = qc;
+    }
+  }
+  return *best;
+}
+
+static Header_Builder&
+StartHeader(Header_Builder& header, const str_ref& status, Date_Cache& date, bool keepAlive)
+{
+  return header.status(status)
+               .field("Connection", keepAlive ? "keep-alive" : "close")
+               .field("Date", date.get());
+}
+
+Header_Builder&
+StartSuccessHeader(Header_Builder& header, Date_Cache& date, bool keepAlive)
+{
+  return StartHeader(header, "HTTP/1.1 200 OK", date, keepAlive);
+}
+
+str_ref
+MakeSuccessHeader(
+  Header_Builder& header,
+  Date_Cache& date,
+  const str_ref& mime_type,
+  const size_t length,
+  bool keepAlive
+  )
+{
+  return StartSuccessHeader(header, date, keepAlive)
+               .field("Content-Type", mime_type)
+               .field("Content-Length", length)
+               .finish();
+}
+
+// The Cache-Control line is preformatted; Expires moves with the clock
+static Header_Builder&
+AddLifetime(Header_Builder& header, Date_Cache& date, const cached_file &f)
+{
+  if ( f.max_age < 0 ) return header;
+  return header.raw(f.cache_control)
+               .field("Expires", date.later(f.max_age));
+}
+
+Header_Builder&
+StartFileHeader(Header_Builder& header, Date_Cache& date, const cached_file &f, bool keepAlive)
+{
+  return AddLifetime(StartSuccessHeader(header, date, keepAlive), date, f)
+               .raw(f.content_encoding)
+               .raw(f.vary);
+}
+
+str_ref
+MakeFileHeader(Header_Builder& header, Date_Cache& date, const cached_file &f, bool keepAlive)
+{
+  return StartFileHeader(header, date, f, keepAlive)
+               .raw(f.validators)
+               .field("Accept-Ranges", "bytes")
+               .field("Content-Type", f.mime)
+               .field("Content-Length", f.size)
+               .finish();
+}
+
+str_ref
+MakeNotModifiedHeader(Header_Builder& header, Date_Cache& date, const cached_file &f, bool keepAlive)
+{
+  return AddLifetime(StartHeader(header, "HTTP/1.1 304 Not Modified", date, keepAlive), date, f)
+               .raw(f.vary)
+               .raw(f.validators)
+               .finish();
+}
+
+// "bytes first-last/size", or "bytes */size" for a 416
+static str_ref
+content_range(char *buf, const byte_range *r, uint64_t size)
+{
+  char *p = buf;
+  memcpy(p, "bytes ", 6); p += 6;
+  if ( r )
+  {
+    p += format_decimal(r->first, p);
+    *p++ = '-';
+    p += format_decimal(r->last, p);
+  }
+  else
+  {
+    *p++ = '*';
+  }
+  *p++ = '/';
+  p += format_decimal(size, p);
+  return str_ref(buf, p - buf);
+}
+
+// Room for "bytes " and three numbers
+const size_t CONTENT_RANGE_MAX = 6 + 3 * 20 + 2;
+
+static Header_Builder&
+StartPartialHeader(Header_Builder& header, Date_Cache& date, const cached_file &f, bool keepAlive)
+{
+  return AddLifetime(StartHeader(header, "HTTP/1.1 206 Partial Content", date, keepAlive), date, f)
+               .raw(f.content_encoding)
+               .raw(f.vary)
+               .raw(f.validators);
+}
+
+str_ref
+MakePartialHeader(Header_Builder& header, Date_Cache& date, const cached_file &f,
+                  const byte_range &range, bool keepAlive)
+{
+  char buf[CONTENT_RANGE_MAX];
+  return StartPartialHeader(header, date, f, keepAlive)
+               .field("Content-Type", f.mime)
+               .field("Content-Range", content_range(buf, &range, f.size))
+               .field("Content-Length", range.length())
+               .finish();
+}
+
+str_ref
+MakeRangeNotSatisfiableHeader(Header_Builder& header, Date_Cache& date, const cached_file &f, bool keepAlive)
+{
+  char buf[CONTENT_RANGE_MAX];
+  return StartHeader(header, "HTTP/1.1 416 Range Not Satisfiable", date, keepAlive)
+               .raw(f.vary)
+               .field("Content-Range", content_range(buf, NULL, f.size))
+               .field("Content-Length", static_cast<uint64_t>(0))
+               .finish();
+}
+
+size_t
+AddByteranges(evbuffer *output, Arena &arena, Date_Cache& date, const cached_file &f,
+              const byte_range *ranges, int count, bool keepAlive)
+{
+  // The boundary mustn't turn up in the body; one made from the ETag
+  // (without its quotes) is unlikely to
+  str_ref tag = str_ref(f.etag).substr(1, f.etag.size() - 2);
+  str_ref boundary(arena.concat("mcbride-", tag), 8 + tag.len);
+
+  // The part headers come first, so the body's length is known for
+  // the response header
+  const size_t PART_MAX = 64 + boundary.len + f.mime.size() + CONTENT_RANGE_MAX;
+  str_ref *parts = static_cast<str_ref*>(arena.allocate(count * sizeof(str_ref), alignof(str_ref)));
+  size_t length = 0;
+  for (int i = 0; i < count; ++i)
+  {
+    char *buf = static_cast<char*>(arena.allocate(PART_MAX, 1));
+    char range[CONTENT_RANGE_MAX];
+    parts[i] = BuildHeader(arena, buf, PART_MAX, [&](Header_Builder &b) {
+      return b.raw("\r\n--").raw(boundary).raw("\r\n")
+              .field("Content-Type", f.mime)
+              .field("Content-Range", content_range(range, &ranges[i], f.size))
+              .finish();
+    });
+    length += parts[i].len + ranges[i].length();
+  }
+  length += 8 + boundary.len; // "\r\n--" boundary "--\r\n"
+
+  char type_buf[128];
+  Header_Builder type(type_buf, sizeof type_buf);
+  type.raw("multipart/byteranges; boundary=").raw(boundary);
+
+  char header_buffer[512];
+  str_ref h = BuildHeader(arena, header_buffer, sizeof header_buffer, [&](Header_Builder &b) {
+    return StartPartialHeader(b, date, f, keepAlive)
+                .field("Content-Type", type.text())
+                .field("Content-Length", length)
+                .finish();
+  });
+  evbuffer_add(output, h.data, h.len);
+  for (int i = 0; i < count; ++i)
+  {
+    evbuffer_add(output, parts[i].data, parts[i].len);
+    evbuffer_add_file_segment(output, f.segment, ranges[i].first, ranges[i].length());
+  }
+  char closing_buf[96];
+  Header_Builder closing(closing_buf, sizeof closing_buf);
+  str_ref c = closing.raw("\r\n--").raw(boundary).raw("--\r\n").text();
+  evbuffer_add(output, c.data, c.len);
+  return length;
+}
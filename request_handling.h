@@ -0,0 +1,139 @@
+#ifndef REQUEST_HANDLING_H
+#define REQUEST_HANDLING_H
+
+#include <stddef.h>
+#include "str_ref.h"
+#include "class_HTTP_Parser.h"
+#include "class_Arena.h"
+#include "http_response.h"
+
+struct evbuffer;
+struct cached_file;
+
+// Turning the bytes a connection has read into requests, and the
+// responses to them, with no ties to the connection or event loop
+// beyond the input buffer. The server and the benchmarks link the same
+// code.
+
+// Lives in the connection's arena, so it must stay trivially destructible
+class http_request : public http_message {
+public:
+  http_request():
+    next(NULL)
+  {
+  }
+
+  void
+  uri_set(const str_ref &uri)
+  {
+    m_uri = uri;
+  }
+
+  const str_ref&
+  uri() const {
+    return m_uri;
+  }
+
+  bool keepAlive() const {
+    return headers.get(H_CONNECTION).iequals("keep-alive");
+  }
+
+  http_request *next; // next request of the same pipelined batch
+
+private:
+  str_ref m_uri;
+};
+
+// Parse every complete request sitting in input in one pass and link
+// them into *requests; returns the bytes they took up. tag prefixes the
+// log lines.
+size_t CreateRequests(evbuffer *input, HTTP_Parser &parser, Arena &arena, const char *tag, http_request **requests);
+
+// Error responses are assembled in the arena
+str_ref MakeError(Arena &arena, const str_ref &status, const str_ref &what, const str_ref &detail = str_ref());
+str_ref Make400(Arena &arena, const str_ref &problem, const str_ref &req);
+str_ref Make404(Arena &arena, const str_ref &file);
+str_ref Make500();
+str_ref Make501(Arena &arena, const str_ref &file);
+
+// Which of f's entries to send: the precompressed variant whose coding
+// Accept-Encoding gives the highest q-value, the smallest of those it
+// rates the same, or f itself if it rates none of them at least as high
+// as identity. "gzip;q=0.1, identity" gets f, "gzip, identity" the gzip
+// variant.
+const cached_file& Negotiate(const http_request &req, const cached_file &f);
+
+// Whether a GET for f can be answered with a 304: its ETag is in
+// If-None-Match (or that is "*"), or, when there is no If-None-Match,
+// it hasn't been modified since If-Modified-Since
+bool NotModified(const http_request &req, const cached_file &f);
+
+// One of the ranges a Range header asks for, resolved against the
+// file: its first and last byte
+struct byte_range
+{
+  uint64_t first;
+  uint64_t last;
+
+  uint64_t length() const { return last - first + 1; }
+};
+
+// A Range header asking for more than this many ranges is ignored
+const int MAX_RANGES = 16;
+
+// The parts of f a GET asks for with Range, put into ranges in order,
+// with any that overlap or touch merged. Returns how many there are, 0
+// if none of them is within the file (a 416), or -1 if the whole file
+// should be sent: there is no Range, it doesn't parse, it asks for too
+// many ranges, or If-Range doesn't name the current file.
+int RequestedRanges(const http_request &req, const cached_file &f, byte_range *ranges);
+
+// Builds a header into buf with make, which is handed a Header_Builder
+// and returns the header. Content-Types and cache lifetimes come from
+// ws.conf and can be any length, so if buf turns out too small the
+// header is built again in a buffer from the arena that fits it.
+template <typename F>
+str_ref
+BuildHeader(Arena &arena, char *buf, size_t size, F make)
+{
+  Header_Builder header(buf, size);
+  str_ref h = make(header);
+  if ( !header.overflowed() ) return h;
+  size_t needed = header.needed();
+  Header_Builder again(static_cast<char*>(arena.allocate(needed, 1)), needed);
+  return make(again);
+}
+
+// The status, Connection and Date lines of a 200
+Header_Builder& StartSuccessHeader(Header_Builder& header, Date_Cache& date, bool keepAlive);
+
+// A whole 200 header for a body that isn't a file
+str_ref MakeSuccessHeader(Header_Builder& header, Date_Cache& date, const str_ref& mime_type,
+                          const size_t length, bool keepAlive);
+
+// The lines of a 200 for f that differ between requests: those of
+// StartSuccessHeader, then f's Cache-Control and an Expires that far
+// from now. The rest can come precomputed from the content cache.
+Header_Builder& StartFileHeader(Header_Builder& header, Date_Cache& date, const cached_file &f, bool keepAlive);
+
+// A whole 200 header for f
+str_ref MakeFileHeader(Header_Builder& header, Date_Cache& date, const cached_file &f, bool keepAlive);
+
+// A 304 header for f: its validators and lifetime, and no body
+str_ref MakeNotModifiedHeader(Header_Builder& header, Date_Cache& date, const cached_file &f, bool keepAlive);
+
+// A 206 header for one range of f
+str_ref MakePartialHeader(Header_Builder& header, Date_Cache& date, const cached_file &f,
+                          const byte_range &range, bool keepAlive);
+
+// A 416 header for f, which has no body
+str_ref MakeRangeNotSatisfiableHeader(Header_Builder& header, Date_Cache& date, const cached_file &f,
+                                      bool keepAlive);
+
+// A whole 206 response for several ranges of f, as multipart/byteranges:
+// the header and part headers are copied into output, the ranges are
+// added from f's file segment. Returns the length of the body.
+size_t AddByteranges(evbuffer *output, Arena &arena, Date_Cache& date, const cached_file &f,
+                     const byte_range *ranges, int count, bool keepAlive);
+
+#endif
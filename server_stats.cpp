@@ -0,0 +1,216 @@
+#include "server_stats.h"
+#include <sstream>
+#include <iomanip>
+
+void
+histogram_totals::add(const latency_histogram &h)
+{
+  for (int i = 0; i < latency_histogram::BUCKETS; ++i) buckets[i] += h.buckets[i].load(std::memory_order_relaxed);
+  count += h.count.load(std::memory_order_relaxed);
+  sum += h.sum.load(std::memory_order_relaxed);
+}
+
+uint64_t
+histogram_totals::percentile(double q) const
+{
+  // The bucket counts are read one by one while workers keep adding,
+  // so go by their own total rather than count
+  uint64_t total = 0;
+  for (int i = 0; i < latency_histogram::BUCKETS; ++i) total += buckets[i];
+  if ( total == 0 ) return 0;
+
+  uint64_t rank = static_cast<uint64_t>(q * total + 0.5);
+  if ( rank < 1 ) rank = 1;
+  uint64_t seen = 0;
+  for (int i = 0; i < latency_histogram::BUCKETS; ++i)
+  {
+    seen += buckets[i];
+    if ( seen >= rank ) return latency_histogram::highest(i);
+  }
+  return latency_histogram::highest(latency_histogram::BUCKETS - 1);
+}
+
+void
+stats_totals::add(const worker_stats &w, int active_connections)
+{
+  for (int i = 0; i < STATUS_SLOTS; ++i) responses[i] += w.responses[i].load(std::memory_order_relaxed);
+  bytes_sent += w.bytes_sent.load(std::memory_order_relaxed);
+  connections += w.connections.load(std::memory_order_relaxed);
+  keepalive_reuses += w.keepalive_reuses.load(std::memory_order_relaxed);
+  for (int i = 0; i < BATCH_BUCKETS; ++i) batches[i] += w.batches[i].load(std::memory_order_relaxed);
+  batch_requests += w.batch_requests.load(std::memory_order_relaxed);
+  timeouts += w.timeouts.load(std::memory_order_relaxed);
+  parse_errors += w.parse_errors.load(std::memory_order_relaxed);
+  active += active_connections;
+  for (int i = 0; i < STAGES; ++i) stages[i].add(w.stages[i]);
+  for (int i = 0; i < STATUS_SLOTS; ++i) by_status[i].add(w.by_status[i]);
+}
+
+uint64_t
+stats_totals::requests() const
+{
+  uint64_t n = 0;
+  for (int i = 0; i < STATUS_SLOTS; ++i) n += responses[i];
+  return n;
+}
+
+static const double QUANTILES[] = { 0.5, 0.99, 0.999 };
+static const int QUANTILE_COUNT = sizeof QUANTILES / sizeof QUANTILES[0];
+
+static void
+latency_row(std::ostream &out, const std::string &name, const histogram_totals &h)
+{
+  out << "  " << std::left << std::setw(10) << name << std::right;
+  for (int q = 0; q < QUANTILE_COUNT; ++q)
+  {
+    out << std::setw(12) << std::fixed << std::setprecision(1) << h.percentile(QUANTILES[q]) / 1000.0;
+  }
+  out << std::setw(12) << h.count << "\n";
+}
+
+static std::string
+status_label(int slot)
+{
+  if ( slot == SLOT_OTHER ) return "other";
+  std::ostringstream s;
+  s << STATUS_SLOT_CODES[slot];
+  return s.str();
+}
+
+static void
+batch_label(std::ostream &out, int b)
+{
+  unsigned low = b == 0 ? 1 : BATCH_BUCKET_LIMITS[b-1] + 1;
+  if ( b == BATCH_BUCKETS - 1 ) out << low << "+";
+  else if ( low == BATCH_BUCKET_LIMITS[b] ) out << low;
+  else out << low << "-" << BATCH_BUCKET_LIMITS[b];
+}
+
+std::string
+format_status(const stats_totals &total, const std::vector<stats_totals> &workers)
+{
+  std::ostringstream out;
+  out << "McBride server status\n\n";
+  out << "Workers: " << workers.size() << "\n";
+  out << "Active connections: " << total.active << "\n";
+  out << "Connections: " << total.connections << "\n";
+  out << "Requests: " << total.requests() << "\n";
+  out << "Keep-alive reuses: " << total.keepalive_reuses << "\n";
+  out << "Bytes sent: " << total.bytes_sent << "\n";
+  out << "Timeouts: " << total.timeouts << "\n";
+  out << "Parse errors: " << total.parse_errors << "\n";
+
+  out << "\nResponses:\n";
+  for (int i = 0; i < STATUS_SLOTS; ++i)
+  {
+    if ( i == SLOT_OTHER ) out << "  other: ";
+    else out << "  " << STATUS_SLOT_CODES[i] << ": ";
+    out << total.responses[i] << "\n";
+  }
+
+  out << "\nPipelined batches (requests per read):\n";
+  for (int b = 0; b < BATCH_BUCKETS; ++b)
+  {
+    out << "  ";
+    batch_label(out, b);
+    out << ": " << total.batches[b] << "\n";
+  }
+
+  out << "\nLatency (microseconds):\n";
+  out << "  " << std::left << std::setw(10) << "stage" << std::right << std::setw(12) << "p50"
+      << std::setw(12) << "p99" << std::setw(12) << "p999" << std::setw(12) << "count" << "\n";
+  for (int i = 0; i < STAGES; ++i) latency_row(out, STAGE_NAMES[i], total.stages[i]);
+  for (int i = 0; i < STATUS_SLOTS; ++i)
+  {
+    if ( total.by_status[i].count > 0 ) latency_row(out, "<" + status_label(i) + ">", total.by_status[i]);
+  }
+
+  out << "\n";
+  for (size_t i = 0; i < workers.size(); ++i)
+  {
+    out << "Worker " << i << ": active " << workers[i].active << ", connections " << workers[i].connections
+        << ", requests " << workers[i].requests() << ", bytes " << workers[i].bytes_sent << "\n";
+  }
+  return out.str();
+}
+
+static void
+metric(std::ostream &out, const char *name, const char *type, const char *help)
+{
+  out << "# HELP " << name << " " << help << "\n";
+  out << "# TYPE " << name << " " << type << "\n";
+}
+
+static void
+summary(std::ostream &out, const char *name, const char *label, const std::string &value, const histogram_totals &h)
+{
+  for (int q = 0; q < QUANTILE_COUNT; ++q)
+  {
+    out << name << "{" << label << "=\"" << value << "\",quantile=\"" << QUANTILES[q] << "\"} "
+        << h.percentile(QUANTILES[q]) / 1e9 << "\n";
+  }
+  out << name << "_sum{" << label << "=\"" << value << "\"} " << h.sum / 1e9 << "\n";
+  out << name << "_count{" << label << "=\"" << value << "\"} " << h.count << "\n";
+}
+
+std::string
+format_prometheus(const stats_totals &total, const std::vector<stats_totals> &workers)
+{
+  std::ostringstream out;
+
+  metric(out, "mcbride_responses_total", "counter", "Responses sent, by status code.");
+  for (int i = 0; i < STATUS_SLOTS; ++i)
+  {
+    out << "mcbride_responses_total{code=\"";
+    if ( i == SLOT_OTHER ) out << "other";
+    else out << STATUS_SLOT_CODES[i];
+    out << "\"} " << total.responses[i] << "\n";
+  }
+
+  metric(out, "mcbride_bytes_sent_total", "counter", "Response bytes queued on connections, headers included.");
+  out << "mcbride_bytes_sent_total " << total.bytes_sent << "\n";
+
+  metric(out, "mcbride_connections_total", "counter", "Connections accepted.");
+  out << "mcbride_connections_total " << total.connections << "\n";
+
+  metric(out, "mcbride_active_connections", "gauge", "Connections currently open, by worker.");
+  for (size_t i = 0; i < workers.size(); ++i)
+  {
+    out << "mcbride_active_connections{worker=\"" << i << "\"} " << workers[i].active << "\n";
+  }
+
+  metric(out, "mcbride_keepalive_reuses_total", "counter", "Requests served on an already used connection.");
+  out << "mcbride_keepalive_reuses_total " << total.keepalive_reuses << "\n";
+
+  metric(out, "mcbride_pipeline_batch_size", "histogram", "Requests answered per read from a connection.");
+  uint64_t cumulative = 0;
+  uint64_t count = 0;
+  for (int b = 0; b < BATCH_BUCKETS; ++b)
+  {
+    cumulative += total.batches[b];
+    count += total.batches[b];
+    out << "mcbride_pipeline_batch_size_bucket{le=\"";
+    if ( b == BATCH_BUCKETS - 1 ) out << "+Inf";
+    else out << BATCH_BUCKET_LIMITS[b];
+    out << "\"} " << cumulative << "\n";
+  }
+  out << "mcbride_pipeline_batch_size_sum " << total.batch_requests << "\n";
+  out << "mcbride_pipeline_batch_size_count " << count << "\n";
+
+  metric(out, "mcbride_stage_latency_seconds", "summary", "Time spent in each stage of answering requests.");
+  for (int i = 0; i < STAGES; ++i) summary(out, "mcbride_stage_latency_seconds", "stage", STAGE_NAMES[i], total.stages[i]);
+
+  metric(out, "mcbride_response_latency_seconds", "summary", "Time from reading a batch of requests to queueing each response, by status code.");
+  for (int i = 0; i < STATUS_SLOTS; ++i)
+  {
+    summary(out, "mcbride_response_latency_seconds", "code", status_label(i), total.by_status[i]);
+  }
+
+  metric(out, "mcbride_timeouts_total", "counter", "Connections closed for being idle.");
+  out << "mcbride_timeouts_total " << total.timeouts << "\n";
+
+  metric(out, "mcbride_parse_errors_total", "counter", "Requests that couldn't be parsed.");
+  out << "mcbride_parse_errors_total " << total.parse_errors << "\n";
+
+  return out.str();
+}
@@ -0,0 +1,195 @@
+#ifndef SERVER_STATS_H
+#define SERVER_STATS_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+// Status codes counted separately; anything else is "other"
+enum status_slot
+{
+  SLOT_200,
+  SLOT_206,
+  SLOT_304,
+  SLOT_400,
+  SLOT_404,
+  SLOT_416,
+  SLOT_500,
+  SLOT_501,
+  SLOT_OTHER,
+  STATUS_SLOTS
+};
+
+static const int STATUS_SLOT_CODES[STATUS_SLOTS] = { 200, 206, 304, 400, 404, 416, 500, 501, 0 };
+
+inline status_slot
+slot_for_status(int code)
+{
+  for (int i = 0; i < SLOT_OTHER; ++i)
+  {
+    if ( STATUS_SLOT_CODES[i] == code ) return static_cast<status_slot>(i);
+  }
+  return SLOT_OTHER;
+}
+
+// Pipelined batch sizes are counted in buckets of 1, 2, 3-4, 5-8, 9-16
+// and 17 or more requests
+static const int BATCH_BUCKETS = 6;
+static const unsigned BATCH_BUCKET_LIMITS[BATCH_BUCKETS] = { 1, 2, 4, 8, 16, ~0u };
+
+inline int
+batch_bucket(size_t n)
+{
+  int b = 0;
+  while ( n > BATCH_BUCKET_LIMITS[b] ) ++b;
+  return b;
+}
+
+typedef std::atomic<uint64_t> counter;
+
+// Only the owning thread writes a counter, so an increment is a plain
+// load and store rather than a locked read-modify-write
+inline void
+bump(counter &c, uint64_t n = 1)
+{
+  c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+// Stages of answering a request that get their own latency histogram
+enum request_stage
+{
+  STAGE_PARSE,   // CreateRequests, per batch
+  STAGE_RESOLVE, // file and content cache lookups, open and fstat on a miss
+  STAGE_HEADER,  // building the response header
+  STAGE_ENQUEUE, // adding header and body to the output buffer
+  STAGE_DRAIN,   // until the output buffer has been written out
+  STAGES
+};
+
+static const char* const STAGE_NAMES[STAGES] = { "parse", "resolve", "header", "enqueue", "drain" };
+
+inline uint64_t
+now_ns()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000u + ts.tv_nsec;
+}
+
+// Log-linear latency histogram in the style of HdrHistogram. Values in
+// nanoseconds are bucketed by power of two, and each power of two is
+// split into SUB_BUCKETS linear steps, so a bucket is never wider than
+// an eighth of the values in it. Tops out at about two hours.
+struct latency_histogram
+{
+  static const int SUB_BITS = 3;
+  static const int SUB_BUCKETS = 1 << SUB_BITS;
+  static const int BUCKETS = 41 * SUB_BUCKETS;
+
+  latency_histogram(): buckets(), count(), sum() {}
+
+  static int
+  bucket(uint64_t v)
+  {
+    if ( v < static_cast<uint64_t>(SUB_BUCKETS) ) return v;
+    int shift = 63 - __builtin_clzll(v) - SUB_BITS;
+    int b = (shift + 1) * SUB_BUCKETS + ((v >> shift) & (SUB_BUCKETS - 1));
+    return b < BUCKETS ? b : BUCKETS - 1;
+  }
+
+  // The largest value that lands in bucket b
+  static uint64_t
+  highest(int b)
+  {
+    if ( b < SUB_BUCKETS ) return b;
+    int shift = b / SUB_BUCKETS - 1;
+    uint64_t low = static_cast<uint64_t>(SUB_BUCKETS + b % SUB_BUCKETS) << shift;
+    return low + (1ull << shift) - 1;
+  }
+
+  void
+  record(uint64_t ns)
+  {
+    bump(buckets[bucket(ns)]);
+    bump(count);
+    bump(sum, ns);
+  }
+
+  counter buckets[BUCKETS];
+  counter count;
+  counter sum;
+};
+
+// One or more latency_histograms added up
+struct histogram_totals
+{
+  histogram_totals() { memset(this, 0, sizeof *this); }
+
+  void add(const latency_histogram &h);
+
+  // The value below which a fraction q of the samples fall, to within
+  // the bucket resolution; 0 without samples
+  uint64_t percentile(double q) const;
+
+  uint64_t buckets[latency_histogram::BUCKETS];
+  uint64_t count;
+  uint64_t sum;
+};
+
+// One worker's counters. Other threads only ever read them, to add
+// them up when the status page is asked for. The padding on either
+// side keeps them off cache lines that anything else writes.
+struct worker_stats
+{
+  worker_stats():
+      responses(), bytes_sent(), connections(), keepalive_reuses(),
+      batches(), batch_requests(), timeouts(), parse_errors()
+  {}
+
+  char pad_front[64];
+  counter responses[STATUS_SLOTS];
+  counter bytes_sent;       // queued on connections, headers included
+  counter connections;      // opened
+  counter keepalive_reuses; // requests after the first on a connection
+  counter batches[BATCH_BUCKETS];
+  counter batch_requests;
+  counter timeouts;
+  counter parse_errors;
+  latency_histogram stages[STAGES];
+  latency_histogram by_status[STATUS_SLOTS]; // from the start of the batch to the response being queued
+  char pad_back[64];
+};
+
+// Plain copy of one or more workers' counters
+struct stats_totals
+{
+  stats_totals():
+      responses(), bytes_sent(0), connections(0), keepalive_reuses(0),
+      batches(), batch_requests(0), timeouts(0), parse_errors(0), active(0)
+  {}
+
+  void add(const worker_stats &w, int active);
+
+  uint64_t responses[STATUS_SLOTS];
+  uint64_t bytes_sent;
+  uint64_t connections;
+  uint64_t keepalive_reuses;
+  uint64_t batches[BATCH_BUCKETS];
+  uint64_t batch_requests;
+  uint64_t timeouts;
+  uint64_t parse_errors;
+  int64_t active;
+  histogram_totals stages[STAGES];
+  histogram_totals by_status[STATUS_SLOTS];
+
+  uint64_t requests() const;
+};
+
+// The status page, for people or in the Prometheus text format
+std::string format_status(const stats_totals &total, const std::vector<stats_totals> &workers);
+std::string format_prometheus(const stats_totals &total, const std::vector<stats_totals> &workers);
+
+#endif
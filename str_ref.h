@@ -0,0 +1,66 @@
+#ifndef STR_REF_H
+#define STR_REF_H
+
+#include <string>
+#include <string.h>
+#include <strings.h>
+
+// A non-owning view of a run of characters, in the spirit of C++17's
+// std::string_view. Used to point into connection buffers and other
+// long-lived storage without copying.
+struct str_ref
+{
+  const char *data;
+  size_t len;
+
+  str_ref(): data(""), len(0) {}
+  str_ref(const char *d, size_t l): data(d), len(l) {}
+  str_ref(const char *s): data(s), len(strlen(s)) {}
+  str_ref(const std::string &s): data(s.data()), len(s.length()) {}
+
+  bool empty() const { return len == 0; }
+  size_t length() const { return len; }
+  const char* begin() const { return data; }
+  const char* end() const { return data + len; }
+  char operator[](size_t i) const { return data[i]; }
+
+  std::string str() const { return std::string(data, len); }
+
+  str_ref
+  substr(size_t pos, size_t n = std::string::npos) const
+  {
+    if ( pos > len ) pos = len;
+    if ( n > len - pos ) n = len - pos;
+    return str_ref(data + pos, n);
+  }
+
+  size_t
+  rfind(char c) const
+  {
+    for (size_t i = len; i > 0; --i)
+    {
+      if ( data[i-1] == c ) return i-1;
+    }
+    return std::string::npos;
+  }
+
+  bool
+  equals(const str_ref &o) const
+  {
+    return len == o.len && memcmp(data, o.data, len) == 0;
+  }
+
+  bool
+  iequals(const str_ref &o) const
+  {
+    return len == o.len && strncasecmp(data, o.data, len) == 0;
+  }
+
+  bool
+  starts_with(const str_ref &o) const
+  {
+    return len >= o.len && memcmp(data, o.data, o.len) == 0;
+  }
+};
+
+#endif
@@ -0,0 +1,178 @@
+// mcbride-logcat: prints a binary access log (AccessLogFormat binary in
+// ws.conf) as text lines like the text access log, or as JSON, one
+// object per line.
+//
+// mcbride-logcat [--json] access.log
+//
+// g++ --std=c++11 -O2 -o mcbride-logcat tools/mcbride_logcat.cpp
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+
+#include "../binary_log.h"
+
+static void
+print_json_string(const std::string &s)
+{
+  putchar('"');
+  for (size_t i = 0; i < s.size(); ++i)
+  {
+    unsigned char c = s[i];
+    if ( c == '"' || c == '\\' ) printf("\\%c", c);
+    else if ( c < 0x20 ) printf("\\u%04x", c);
+    else putchar(c);
+  }
+  putchar('"');
+}
+
+static void
+usage()
+{
+  fprintf(stderr, "usage: mcbride-logcat [--json] <access log>\n");
+}
+
+int
+main(int argc, char **argv)
+{
+  bool json = false;
+  const char *path = NULL;
+  for (int i = 1; i < argc; ++i)
+  {
+    if ( strcmp(argv[i], "--json") == 0 ) json = true;
+    else if ( !path ) path = argv[i];
+    else
+    {
+      usage();
+      return 2;
+    }
+  }
+  if ( !path )
+  {
+    usage();
+    return 2;
+  }
+
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if ( fd < 0 || fstat(fd, &st) != 0 )
+  {
+    perror(path);
+    return 1;
+  }
+  if ( st.st_size < static_cast<off_t>(sizeof BINARY_LOG_MAGIC) )
+  {
+    fprintf(stderr, "%s: not a binary access log\n", path);
+    return 1;
+  }
+  void *m = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if ( m == MAP_FAILED )
+  {
+    perror(path);
+    return 1;
+  }
+
+  const uint8_t *p = static_cast<const uint8_t*>(m);
+  const uint8_t *end = p + st.st_size;
+  if ( memcmp(p, BINARY_LOG_MAGIC, sizeof BINARY_LOG_MAGIC) != 0 )
+  {
+    fprintf(stderr, "%s: not a binary access log\n", path);
+    return 1;
+  }
+  p += sizeof BINARY_LOG_MAGIC;
+
+  std::vector<std::string> strings;
+  std::vector<uint64_t> statuses;
+  int64_t time = 0;
+  unsigned long records = 0;
+  unsigned long dropped = 0;
+
+  while ( p < end && *p != BL_END )
+  {
+    const uint8_t *next = skip_binary_log_entry(p, end);
+    if ( !next )
+    {
+      fprintf(stderr, "%s: truncated entry at offset %ld\n", path, static_cast<long>(p - static_cast<const uint8_t*>(m)));
+      return 1;
+    }
+
+    uint8_t tag = *p++;
+    uint64_t v;
+    if ( tag == BL_SESSION )
+    {
+      p = get_varint(p, end, v);
+      time = v;
+      strings.clear();
+      statuses.clear();
+    }
+    else if ( tag == BL_STRING )
+    {
+      p = get_varint(p, end, v);
+      strings.push_back(std::string(reinterpret_cast<const char*>(p), v));
+    }
+    else if ( tag == BL_STATUS )
+    {
+      p = get_varint(p, end, v);
+      statuses.push_back(v);
+    }
+    else if ( tag == BL_DROPPED )
+    {
+      p = get_varint(p, end, v);
+      if ( json ) printf("{\"dropped\":%llu}\n", static_cast<unsigned long long>(v));
+      else printf("access log overflowed, %llu records dropped\n", static_cast<unsigned long long>(v));
+      dropped += v;
+    }
+    else // BL_RECORD
+    {
+      uint64_t f[6];
+      for (int i = 0; i < 6; ++i) p = get_varint(p, end, f[i]);
+      time += unzigzag(f[0]);
+      uint64_t status = f[1] / 2 < statuses.size() ? statuses[f[1] / 2] : 0;
+      bool keep_alive = f[1] & 1;
+      std::string uri = f[2] < strings.size() ? strings[f[2]] : std::string();
+      const std::string *note = f[3] && f[3] - 1 < strings.size() ? &strings[f[3] - 1] : NULL;
+
+      time_t t = time;
+      tm parts;
+      localtime_r(&t, &parts);
+      char stamp[32];
+
+      if ( json )
+      {
+        strftime(stamp, sizeof stamp, "%Y-%m-%dT%H:%M:%S%z", &parts);
+        printf("{\"time\":\"%s\",\"connection\":%llu,\"status\":%llu,\"uri\":", stamp,
+               static_cast<unsigned long long>(f[4]), static_cast<unsigned long long>(status));
+        print_json_string(uri);
+        printf(",\"bytes\":%llu,\"keep_alive\":%s", static_cast<unsigned long long>(f[5]), keep_alive ? "true" : "false");
+        if ( note )
+        {
+          printf(",\"note\":");
+          print_json_string(*note);
+        }
+        printf("}\n");
+      }
+      else
+      {
+        strftime(stamp, sizeof stamp, "%Y-%m-%d %H:%M:%S", &parts);
+        printf("<%s> [%02llu]: <%llu>: %s", stamp, static_cast<unsigned long long>(f[4]),
+               static_cast<unsigned long long>(status), uri.c_str());
+        if ( status == 200 || status == 206 ) printf(" %llu", static_cast<unsigned long long>(f[5]));
+        if ( note ) printf("%s%s", uri.empty() ? "" : " ", note->c_str());
+        printf(" ~ (%s)\n", keep_alive ? "KEEP-ALIVE" : "CLOSE");
+      }
+      ++records;
+    }
+    p = next;
+  }
+
+  if ( !json ) fprintf(stderr, "%lu records, %lu dropped\n", records, dropped);
+  munmap(m, st.st_size);
+  close(fd);
+  return 0;
+}